@@ -0,0 +1,158 @@
+/*
+ * Microbenchmark of the mat:: kernels against the glm path they
+ * replace. Build with -DRENDER_BENCH=ON (and -DRENDER_NATIVE=ON for
+ * the AVX paths), then run ./mat-bench [N].
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <limits>
+#include <vector>
+#include <chrono>
+#include <glm/glm.hpp>
+#include <glm/mat4x4.hpp>
+
+#include "mat.hpp"
+
+#define DEFAULT_N 100000
+#define REPEATS 20
+
+#define clock std::chrono::high_resolution_clock
+
+/* mat::rot as it was: basis change * z rotation * basis change */
+static glm::mat3 rot_basis(const float &theta, const glm::vec3 &a) {
+  glm::vec3 w, u, v;
+  w = glm::normalize(a);
+
+  glm::vec3 t = w;
+  int minInd = 0;
+  {
+    float min = std::numeric_limits<float>::max();
+    int i;
+    for (i=0; i<3; i++) {
+      if (w[i] < min) {
+        minInd = i;
+        min = w[i];
+      }
+    }
+  }
+  t[minInd] = 1;
+
+  u = glm::normalize(glm::cross(t,w));
+  v = glm::cross(w, u);
+
+  glm::mat3 R_inv(u, v, w);
+  glm::mat3 R = glm::transpose(R_inv);
+  glm::mat3 Rot = glm::transpose(glm::mat3(
+    cos(theta), -sin(theta), 0,
+    sin(theta), cos(theta), 0,
+    0, 0, 1
+  ));
+
+  return R_inv*Rot*R;
+}
+
+static float frand() {
+  return (float)rand() / (float)RAND_MAX * 2.0f - 1.0f;
+}
+
+static glm::vec3 rand_axis() {
+  return glm::vec3(frand(), frand(), frand()) + glm::vec3(0.0f, 0.0f, 2.0f);
+}
+
+template <int N, typename M>
+static float max_diff(const M &a, const M &b) {
+  float d = 0.0f;
+  int i, j;
+  for (i=0; i<N; i++) {
+    for (j=0; j<N; j++) {
+      d = fmaxf(d, fabsf(a[i][j] - b[i][j]));
+    }
+  }
+  return d;
+}
+
+/* Best of REPEATS runs, in nanoseconds per element */
+template <typename F>
+static double best_ns(size_t n, F f) {
+  double best = 1e30;
+  int r;
+  for (r=0; r<REPEATS; r++) {
+    clock::time_point tic = clock::now();
+    f();
+    clock::time_point toc = clock::now();
+    double ns = std::chrono::duration<double, std::nano>(toc - tic).count();
+    best = fmin(best, ns / n);
+  }
+  return best;
+}
+
+static void report(const char *name, double before, double after, float err) {
+  printf("%-22s glm %7.2f ns  mat %7.2f ns  %5.2fx  (max diff %g)\n",
+    name, before, after, before / after, err);
+}
+
+int main(int argc, char *argv[]) {
+  size_t n = argc > 1 ? (size_t)atol(argv[1]) : DEFAULT_N;
+
+  std::vector<float> theta(n);
+  std::vector<glm::vec3> axis(n);
+  std::vector<glm::mat3> R0(n), R1(n);
+  std::vector<glm::mat4> A(n), B(n), C0(n), C1(n), rigid(n);
+  size_t i;
+  for (i=0; i<n; i++) {
+    theta[i] = frand() * 3.14159f;
+    axis[i] = rand_axis();
+
+    int j, k;
+    for (j=0; j<4; j++) {
+      for (k=0; k<4; k++) {
+        A[i][j][k] = frand();
+        B[i][j][k] = frand();
+      }
+    }
+    rigid[i] = glm::mat4(mat::rot(theta[i], axis[i]));
+    rigid[i][3] = glm::vec4(frand(), frand(), frand(), 1.0f);
+  }
+
+  double before, after;
+  float err;
+
+  before = best_ns(n, [&]() {
+    for (size_t i=0; i<n; i++) R0[i] = rot_basis(theta[i], axis[i]);
+  });
+  after = best_ns(n, [&]() {
+    for (size_t i=0; i<n; i++) R1[i] = mat::rot(theta[i], axis[i]);
+  });
+  for (err=0.0f, i=0; i<n; i++) err = fmaxf(err, max_diff<3>(R0[i], R1[i]));
+  report("rot (axis-angle)", before, after, err);
+
+  before = best_ns(n, [&]() {
+    for (size_t i=0; i<n; i++) C0[i] = glm::inverse(rigid[i]);
+  });
+  after = best_ns(n, [&]() {
+    for (size_t i=0; i<n; i++) C1[i] = mat::rigid_inverse(rigid[i]);
+  });
+  for (err=0.0f, i=0; i<n; i++) err = fmaxf(err, max_diff<4>(C0[i], C1[i]));
+  report("rigid inverse", before, after, err);
+
+  before = best_ns(n, [&]() {
+    for (size_t i=0; i<n; i++) C0[i] = A[i] * B[i];
+  });
+  after = best_ns(n, [&]() {
+    mat::mul_batch(A.data(), B.data(), C1.data(), n);
+  });
+  for (err=0.0f, i=0; i<n; i++) err = fmaxf(err, max_diff<4>(C0[i], C1[i]));
+  report("mat4 mul (batch)", before, after, err);
+
+  before = best_ns(n, [&]() {
+    for (size_t i=0; i<n; i++) C0[i] = A[0] * B[i];
+  });
+  after = best_ns(n, [&]() {
+    mat::mul_batch(A[0], B.data(), C1.data(), n);
+  });
+  for (err=0.0f, i=0; i<n; i++) err = fmaxf(err, max_diff<4>(C0[i], C1[i]));
+  report("mat4 mul (one x many)", before, after, err);
+
+  return 0;
+}
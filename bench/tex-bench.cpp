@@ -0,0 +1,118 @@
+/*
+ * Benchmark of the load_tex conversion (CImg planes to GL rows)
+ * against the per-pixel loop it replaces, on an 8K texture by
+ * default. Build with -DRENDER_BENCH=ON (and -DRENDER_NATIVE=ON for
+ * the SSSE3 RGB path), then run ./tex-bench [SIZE].
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <chrono>
+
+#include "pixels.hpp"
+
+#define DEFAULT_SIZE 8192
+#define REPEATS 5
+
+#define clock std::chrono::high_resolution_clock
+
+/* What CImg's img(x, y, 0, c) computes */
+typedef struct Planar {
+  const unsigned char *data;
+  int width;
+  int height;
+
+  unsigned char operator()(int x, int y, int z, int c) const {
+    return data[x + (size_t)y * width + (size_t)c * width * height];
+  }
+} Planar;
+
+/* load_tex as it was */
+static void convert_loop(const Planar &img, int M, int N,
+                         unsigned char *data) {
+  int x, y, _y;
+  for (y=0, _y=N-1; y<N; y++, _y--) {
+    for (x=0; x<M; x++) {
+      size_t loc = ((size_t)y * M + x) * 3;
+      data[loc] = img(x, _y, 0, 0);
+      data[loc+1] = img(x, _y, 0, 1);
+      data[loc+2] = img(x, _y, 0, 2);
+    }
+  }
+}
+
+/* Best of REPEATS runs, in milliseconds */
+template <typename F>
+static double best_ms(F f) {
+  double best = 1e30;
+  int r;
+  for (r=0; r<REPEATS; r++) {
+    clock::time_point tic = clock::now();
+    f();
+    clock::time_point toc = clock::now();
+    best = fmin(best,
+      std::chrono::duration<double, std::milli>(toc - tic).count());
+  }
+  return best;
+}
+
+static void report(const char *name, double before, double after,
+                   bool same) {
+  printf("%-24s loop %8.2f ms  new %8.2f ms  %6.2fx  (%s)\n",
+    name, before, after, before / after, same ? "same" : "DIFFERENT");
+}
+
+int main(int argc, char *argv[]) {
+  int size = argc > 1 ? atoi(argv[1]) : DEFAULT_SIZE;
+  size_t n = (size_t)size * size;
+
+  std::vector<unsigned char> planes(4 * n);
+  size_t i;
+  for (i=0; i<planes.size(); i++) {
+    planes[i] = (unsigned char)rand();
+  }
+  Planar img = {planes.data(), size, size};
+
+  std::vector<unsigned char> expected(3 * n), rgb(3 * n), rgba(4 * n);
+  double before = best_ms([&]() {
+    convert_loop(img, size, size, expected.data());
+  });
+  printf("%dx%d, %.1f MB RGB\n", size, size, expected.size() / 1e6);
+
+  double after = best_ms([&]() {
+    pixels::planar_to_gl(planes.data(), size, size, 3,
+                         size, size, 3, rgb.data(), 1);
+  });
+  report("RGB, 1 thread", before, after, rgb == expected);
+
+  std::fill(rgb.begin(), rgb.end(), 0);
+  after = best_ms([&]() {
+    pixels::planar_to_gl(planes.data(), size, size, 3,
+                         size, size, 3, rgb.data());
+  });
+  report("RGB, all cores", before, after, rgb == expected);
+
+  /* RGBA against the RGB loop plus the alpha plane */
+  after = best_ms([&]() {
+    pixels::planar_to_gl(planes.data(), size, size, 4,
+                         size, size, 4, rgba.data());
+  });
+  bool same = true;
+  size_t y, x;
+  for (y=0; y<(size_t)size && same; y++) {
+    const unsigned char *alpha = planes.data() + 3 * n +
+                                 (size - 1 - y) * size;
+    for (x=0; x<(size_t)size; x++) {
+      size_t p = y * size + x;
+      if (memcmp(&rgba[4*p], &expected[3*p], 3) != 0 ||
+          rgba[4*p+3] != alpha[x]) {
+        same = false;
+        break;
+      }
+    }
+  }
+  report("RGBA, all cores", before, after, same);
+  return 0;
+}
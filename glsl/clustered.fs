@@ -0,0 +1,101 @@
+#version 430 core
+
+struct Light {
+  vec4 position; /* w = radius of influence, 0 = unbounded */
+  vec4 intensity;
+  mat4 shadowMat;
+};
+
+layout(std430, binding = 0) readonly buffer LightBuf {
+  Light lights[];
+};
+
+/* (offset, count) into light_indices, one per cluster */
+layout(std430, binding = 1) readonly buffer ClusterBuf {
+  uvec2 clusters[];
+};
+
+layout(std430, binding = 2) readonly buffer IndexBuf {
+  uint light_indices[];
+};
+
+in vec3 vPos;
+in vec3 vNormal;
+in vec2 vTex;
+in float vDepth;
+
+uniform vec3 eye;
+uniform vec3 Ia;
+uniform vec3 ka;
+uniform vec3 kd;
+uniform vec3 ks;
+uniform float p;
+uniform sampler2D tex;
+uniform sampler2DArrayShadow shadows;
+
+uniform uvec3 grid;
+uniform vec2 tile_size;
+uniform float zNear;
+uniform float zFar;
+
+layout(location = 0) out vec4 out_Fragmentcolor;
+
+/* Same tiles and exponential slices as ClusterGrid */
+uint cluster_index() {
+  uvec2 t = min(uvec2(gl_FragCoord.xy / tile_size), grid.xy - 1u);
+  float s = log(vDepth / zNear) / log(zFar / zNear) * float(grid.z);
+  uint z = uint(clamp(s, 0.0, float(grid.z - 1u)));
+  return (z * grid.y + t.y) * grid.x + t.x;
+}
+
+/*
+ * Smooth falloff to exactly 0 at the radius, so a light never
+ * contributes outside the clusters it was binned into.
+ */
+float attenuation(float d, float radius) {
+  if (radius <= 0.0) {
+    return 1.0;
+  }
+  float x = clamp(1.0 - pow(d / radius, 4.0), 0.0, 1.0);
+  return x * x;
+}
+
+void main(void) {
+  /* L = Lambertian, S = Specular, A = Ambience */
+  vec3 L, S, A;
+
+  vec3 n = normalize(vNormal);
+  vec3 v = normalize(eye - vPos);
+  vec3 c = vec3(0,0,0);
+
+  uvec2 cluster = clusters[cluster_index()];
+  uint k;
+  for (k=0u; k<cluster.y; k++) {
+    uint i = light_indices[cluster.x + k];
+    Light light = lights[i];
+
+    vec3 d = light.position.xyz - vPos;
+    float att = attenuation(length(d), light.position.w);
+    if (att <= 0.0) {
+      continue;
+    }
+
+    /* i'th layer of 'shadows' belongs to the i'th light */
+    vec4 sc = light.shadowMat * vec4(vPos, 1.0);
+    vec3 uvz = sc.xyz / sc.w;
+    float s = texture(shadows, vec4(uvz.xy, float(i), uvz.z));
+    if (s > 0.0) {
+      vec3 l = normalize(d);
+      vec3 h = normalize(v + l);
+      vec3 intensity = att * light.intensity.rgb;
+
+      L = intensity * max(0, dot(n, l));
+      S = ks * intensity * pow(max(0, dot(n, h)), p);
+      c += (L+S);
+    }
+  }
+
+  A = ka * Ia;
+  c = min(vec3(1,1,1), A+c);
+  out_Fragmentcolor = vec4(c, 1.0);
+}
@@ -0,0 +1,35 @@
+#version 430 core
+
+/* All in world coordinates */
+out vec3 vPos;
+out vec3 vNormal;
+out vec2 vTex;
+/* Distance in front of the camera, selects the depth slice */
+out float vDepth;
+
+layout(location = 0) in vec3 in_Position;
+layout(location = 1) in vec3 in_Normal;
+layout(location = 2) in vec2 in_Tex;
+
+uniform mat4 model;
+uniform mat4 view;
+/* per * view, multiplied on the CPU */
+uniform mat4 viewProj;
+
+/* Must match the depth pre-pass, see model-view-proj.vs */
+invariant gl_Position;
+
+void main(void) {
+  /*
+   * Unlike model-view-proj.vs, no per-light varyings: the light
+   * vectors and shadow coordinates are computed per fragment for
+   * the lights of its cluster only.
+   */
+  vec4 world = model * vec4(in_Position, 1.0);
+  vPos = world.xyz;
+  vNormal = mat3(model) * in_Normal;
+  vTex = in_Tex;
+  vDepth = -(view * world).z;
+
+  gl_Position = viewProj * model * vec4(in_Position, 1.0);
+}
@@ -0,0 +1,119 @@
+#version 430 core
+
+struct Light {
+  vec4 position; /* w = radius of influence, 0 = unbounded */
+  vec4 intensity;
+  mat4 shadowMat;
+};
+
+/* Same light lists as clustered.fs, built by ClusterGrid */
+layout(std430, binding = 0) readonly buffer LightBuf {
+  Light lights[];
+};
+
+layout(std430, binding = 1) readonly buffer ClusterBuf {
+  uvec2 clusters[];
+};
+
+layout(std430, binding = 2) readonly buffer IndexBuf {
+  uint light_indices[];
+};
+
+in vec2 vUV;
+
+uniform sampler2D albedo;
+uniform sampler2D normal;
+uniform sampler2D depth;
+uniform sampler2DArrayShadow shadows;
+
+uniform mat4 invViewProj;
+uniform mat4 view;
+uniform vec3 eye;
+uniform vec3 Ia;
+uniform vec3 ka;
+uniform vec3 ks;
+uniform float p;
+
+uniform uvec3 grid;
+uniform vec2 tile_size;
+uniform float zNear;
+uniform float zFar;
+
+layout(location = 0) out vec4 out_Fragmentcolor;
+
+vec3 oct_decode(vec2 e) {
+  vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+  if (n.z < 0.0) {
+    n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0,
+                                    n.y >= 0.0 ? 1.0 : -1.0);
+  }
+  return normalize(n);
+}
+
+uint cluster_index(float d) {
+  uvec2 t = min(uvec2(gl_FragCoord.xy / tile_size), grid.xy - 1u);
+  float s = log(d / zNear) / log(zFar / zNear) * float(grid.z);
+  uint z = uint(clamp(s, 0.0, float(grid.z - 1u)));
+  return (z * grid.y + t.y) * grid.x + t.x;
+}
+
+float attenuation(float d, float radius) {
+  if (radius <= 0.0) {
+    return 1.0;
+  }
+  float x = clamp(1.0 - pow(d / radius, 4.0), 0.0, 1.0);
+  return x * x;
+}
+
+void main(void) {
+  ivec2 px = ivec2(gl_FragCoord.xy);
+  float z = texelFetch(depth, px, 0).r;
+  /* Nothing was drawn here, keep the clear color */
+  if (z >= 1.0) {
+    discard;
+  }
+
+  /* Back from NDC to world space */
+  vec4 ndc = vec4(2.0 * vUV - 1.0, 2.0 * z - 1.0, 1.0);
+  vec4 world = invViewProj * ndc;
+  vec3 pos = world.xyz / world.w;
+
+  vec3 kd = texelFetch(albedo, px, 0).rgb;
+  vec3 n = oct_decode(texelFetch(normal, px, 0).rg);
+  vec3 v = normalize(eye - pos);
+  vec3 c = vec3(0,0,0);
+
+  /* L = Lambertian, S = Specular, A = Ambience */
+  vec3 L, S, A;
+
+  uvec2 cluster = clusters[cluster_index(-(view * vec4(pos, 1.0)).z)];
+  uint k;
+  for (k=0u; k<cluster.y; k++) {
+    uint i = light_indices[cluster.x + k];
+    Light light = lights[i];
+
+    vec3 d = light.position.xyz - pos;
+    float att = attenuation(length(d), light.position.w);
+    if (att <= 0.0) {
+      continue;
+    }
+
+    /* i'th layer of 'shadows' belongs to the i'th light */
+    vec4 sc = light.shadowMat * vec4(pos, 1.0);
+    vec3 uvz = sc.xyz / sc.w;
+    float s = texture(shadows, vec4(uvz.xy, float(i), uvz.z));
+    if (s > 0.0) {
+      vec3 l = normalize(d);
+      vec3 h = normalize(v + l);
+      vec3 intensity = att * light.intensity.rgb;
+
+      L = kd * intensity * max(0, dot(n, l));
+      S = ks * intensity * pow(max(0, dot(n, h)), p);
+      c += (L+S);
+    }
+  }
+
+  A = ka * Ia;
+  c = min(vec3(1,1,1), A+c);
+  out_Fragmentcolor = vec4(c, 1.0);
+}
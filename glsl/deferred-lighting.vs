@@ -0,0 +1,13 @@
+#version 430 core
+
+out vec2 vUV;
+
+/*
+ * One triangle covering the screen, from gl_VertexID alone:
+ * (-1,-1), (3,-1), (-1,3). No vertex buffer needed.
+ */
+void main(void) {
+  vec2 p = vec2(float((gl_VertexID << 1) & 2), float(gl_VertexID & 2));
+  vUV = p;
+  gl_Position = vec4(2.0 * p - 1.0, 0.0, 1.0);
+}
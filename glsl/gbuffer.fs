@@ -0,0 +1,31 @@
+#version 430 core
+
+in vec3 vNormal;
+in vec2 vTex;
+
+uniform vec3 kd;
+uniform bool textured;
+uniform sampler2D tex;
+
+layout(location = 0) out vec4 out_Albedo;
+layout(location = 1) out vec2 out_Normal;
+
+/*
+ * Octahedral encoding: project onto the octahedron |x|+|y|+|z| = 1
+ * and fold the lower half over the upper one. 2 channels, and the
+ * error is spread evenly over the sphere.
+ */
+vec2 oct_encode(vec3 n) {
+  n /= abs(n.x) + abs(n.y) + abs(n.z);
+  vec2 e = n.xy;
+  if (n.z < 0.0) {
+    e = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0,
+                                 n.y >= 0.0 ? 1.0 : -1.0);
+  }
+  return e;
+}
+
+void main(void) {
+  out_Albedo = textured ? texture(tex, vTex) : vec4(kd, 1.0);
+  out_Normal = oct_encode(normalize(vNormal));
+}
@@ -0,0 +1,22 @@
+#version 430 core
+
+out vec3 vNormal;
+out vec2 vTex;
+
+layout(location = 0) in vec3 in_Position;
+layout(location = 1) in vec3 in_Normal;
+layout(location = 2) in vec2 in_Tex;
+
+uniform mat4 model;
+/* per * view, multiplied on the CPU */
+uniform mat4 viewProj;
+
+/* Same depth as the other passes, see model-view-proj.vs */
+invariant gl_Position;
+
+void main(void) {
+  vNormal = mat3(model) * in_Normal;
+  vTex = in_Tex;
+
+  gl_Position = viewProj * model * vec4(in_Position, 1.0);
+}
@@ -0,0 +1,44 @@
+#version 430 core
+
+/*
+ * Each texel of level N is the farthest (max) depth of the
+ * texels of level N-1 it covers. When level N-1 has an odd
+ * dimension, the last texel of level N also has to cover the
+ * extra row/column, otherwise it could claim to occlude more
+ * than it does.
+ */
+layout(local_size_x = 8, local_size_y = 8) in;
+
+layout(binding = 0, r32f) uniform readonly image2D src;
+layout(binding = 1, r32f) uniform writeonly image2D dst;
+
+float fetch(ivec2 p) {
+  return imageLoad(src, p).r;
+}
+
+void main(void) {
+  ivec2 p = ivec2(gl_GlobalInvocationID.xy);
+  ivec2 dsize = imageSize(dst);
+  if (any(greaterThanEqual(p, dsize))) {
+    return;
+  }
+
+  ivec2 ssize = imageSize(src);
+  ivec2 s = 2*p;
+  float d = max(max(fetch(s), fetch(s + ivec2(1,0))),
+                max(fetch(s + ivec2(0,1)), fetch(s + ivec2(1,1))));
+
+  bool odd_x = (ssize.x & 1) != 0 && p.x == dsize.x-1;
+  bool odd_y = (ssize.y & 1) != 0 && p.y == dsize.y-1;
+  if (odd_x) {
+    d = max(d, max(fetch(s + ivec2(2,0)), fetch(s + ivec2(2,1))));
+  }
+  if (odd_y) {
+    d = max(d, max(fetch(s + ivec2(0,2)), fetch(s + ivec2(1,2))));
+  }
+  if (odd_x && odd_y) {
+    d = max(d, fetch(s + ivec2(2,2)));
+  }
+
+  imageStore(dst, p, vec4(d));
+}
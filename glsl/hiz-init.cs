@@ -0,0 +1,19 @@
+#version 430 core
+
+/*
+ * Level 0 of the Hi-Z pyramid is a straight copy of the
+ * depth buffer.
+ */
+layout(local_size_x = 8, local_size_y = 8) in;
+
+layout(binding = 0) uniform sampler2D depth;
+layout(binding = 0, r32f) uniform writeonly image2D dst;
+
+void main(void) {
+  ivec2 p = ivec2(gl_GlobalInvocationID.xy);
+  if (any(greaterThanEqual(p, imageSize(dst)))) {
+    return;
+  }
+
+  imageStore(dst, p, vec4(texelFetch(depth, p, 0).r));
+}
@@ -1,6 +1,19 @@
 #version 330 core
 #define MAX_NUM_LIGHTS 4 
 
+/*
+ * Specialization (see ShaderVariants), as in per-frag-blinn-phong.fs.
+ * Without shadows, the shadow map coordinates are not needed.
+ */
+#ifdef NUM_LIGHTS
+#define LIGHT_COUNT NUM_LIGHTS
+#else
+#define LIGHT_COUNT min(num_lights, MAX_NUM_LIGHTS)
+#endif
+#ifndef SHADOWS
+#define SHADOWS 1
+#endif
+
 struct Light {
   vec3 position;
   vec3 intensity;  
@@ -25,9 +38,15 @@ layout(location = 0) in vec3 in_Position;
 layout(location = 1) in vec3 in_Normal;
 layout(location = 2) in vec2 in_Tex;
 
+/*
+ * Must match the depth pre-pass (shadow-map.vs) bit for bit, 
+ * otherwise the GL_EQUAL depth test of the main pass fails.
+ */
+invariant gl_Position;
+
 uniform mat4 model;
-uniform mat4 per;
-uniform mat4 view;
+/* per * view, multiplied on the CPU */
+uniform mat4 viewProj;
 uniform vec3 eye;
 uniform int num_lights;
 uniform Light lights[MAX_NUM_LIGHTS];
@@ -62,20 +81,21 @@ void main(void) {
 
   vec3 l, h;
   int i;
-  int bound = min(num_lights, MAX_NUM_LIGHTS);
-  for (i=0; i<bound; i++) {
+  for (i=0; i<LIGHT_COUNT; i++) {
     vec3 l = normalize(lights[i].position-pos);
     vec3 h = normalize(v+l);
     vLights[i].l = l;
     vLights[i].h = h;
 
+#if SHADOWS
     mat4 shadowMat = lights[i].shadowMat;
     vLights[i].shadowCoords = shadowMat * model * vec4(pos, 1.0);
+#endif
   }
    
   vEye = v;
 
   // Calculate screen coordinates for input vertex
-  vec4 _pos = per * view * model * vec4(pos, 1.0);
+  vec4 _pos = viewProj * model * vec4(pos, 1.0);
   gl_Position = _pos;
 }
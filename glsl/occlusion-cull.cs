@@ -0,0 +1,103 @@
+#version 430 core
+
+layout(local_size_x = 64) in;
+
+struct Bounds {
+  vec4 center;
+  vec4 extent;
+};
+
+struct DrawCmd {
+  uint count;
+  uint instanceCount;
+  uint first;
+  uint baseInstance;
+};
+
+layout(std430, binding = 0) readonly buffer BoundsBuf {
+  Bounds bounds[];
+};
+
+/*
+ * cmds[0..n):  phase 1 - visible last frame (rewritten here
+ *              with this frame's visibility for the next frame)
+ * cmds[n..2n): phase 2 - visible now but not drawn in phase 1
+ */
+layout(std430, binding = 1) buffer CmdBuf {
+  DrawCmd cmds[];
+};
+
+layout(binding = 0) uniform sampler2D hiz;
+
+uniform mat4 viewProj;
+uniform uint num_models;
+uniform int hiz_levels;
+
+bool is_visible(Bounds b) {
+  vec3 c = b.center.xyz;
+  vec3 e = b.extent.xyz;
+
+  /* Screen space bounds of the 8 corners in NDC */
+  vec3 lo = vec3(1e30);
+  vec3 hi = vec3(-1e30);
+  int i;
+  for (i=0; i<8; i++) {
+    vec3 s = vec3((i & 1) != 0 ? 1.0 : -1.0,
+                  (i & 2) != 0 ? 1.0 : -1.0,
+                  (i & 4) != 0 ? 1.0 : -1.0);
+    vec4 p = viewProj * vec4(c + s*e, 1.0);
+
+    /* Crosses the eye plane, cannot project it - keep it */
+    if (p.w <= 0.0) {
+      return true;
+    }
+
+    vec3 ndc = p.xyz / p.w;
+    lo = min(lo, ndc);
+    hi = max(hi, ndc);
+  }
+
+  /* Outside of the frustum */
+  if (any(greaterThan(lo.xy, vec2(1.0))) || 
+      any(lessThan(hi.xy, vec2(-1.0))) ||
+      lo.z > 1.0) {
+    return false;
+  }
+
+  vec2 uv_lo = clamp(lo.xy*0.5 + 0.5, 0.0, 1.0);
+  vec2 uv_hi = clamp(hi.xy*0.5 + 0.5, 0.0, 1.0);
+
+  /*
+   * Pick the level at which the rectangle is at most one texel
+   * wide, so it touches at most 2x2 texels there.
+   */
+  vec2 size = (uv_hi - uv_lo) * vec2(textureSize(hiz, 0));
+  float texels = max(max(size.x, size.y), 1.0);
+  int level = clamp(int(ceil(log2(texels))), 0, hiz_levels-1);
+
+  ivec2 lsize = textureSize(hiz, level);
+  ivec2 a = clamp(ivec2(uv_lo * vec2(lsize)), ivec2(0), lsize-1);
+  ivec2 z = clamp(ivec2(uv_hi * vec2(lsize)), ivec2(0), lsize-1);
+
+  float far = max(max(texelFetch(hiz, a, level).r,
+                      texelFetch(hiz, ivec2(z.x, a.y), level).r),
+                  max(texelFetch(hiz, ivec2(a.x, z.y), level).r,
+                      texelFetch(hiz, z, level).r));
+
+  /* Closest point of the box in window depth */
+  float near = lo.z*0.5 + 0.5;
+  return near <= far;
+}
+
+void main(void) {
+  uint i = gl_GlobalInvocationID.x;
+  if (i >= num_models) {
+    return;
+  }
+
+  bool vis = is_visible(bounds[i]);
+  bool drawn = cmds[i].instanceCount != 0u;
+
+  cmds[num_models + i].instanceCount = (vis && !drawn) ? 1u : 0u;
+  cmds[i].instanceCount = vis ? 1u : 0u;
+}
@@ -1,6 +1,27 @@
 #version 330 core
 #define MAX_NUM_LIGHTS 4 
 
+/*
+ * Specialization (see ShaderVariants). NUM_LIGHTS fixes the light
+ * count so the loops unroll, otherwise the num_lights uniform
+ * decides. TEXTURED, SHADOWS and SHADOW_FILTER (0 hard, 1 PCF)
+ * default to the unspecialized program.
+ */
+#ifdef NUM_LIGHTS
+#define LIGHT_COUNT NUM_LIGHTS
+#else
+#define LIGHT_COUNT min(num_lights, MAX_NUM_LIGHTS)
+#endif
+#ifndef TEXTURED
+#define TEXTURED 1
+#endif
+#ifndef SHADOWS
+#define SHADOWS 1
+#endif
+#ifndef SHADOW_FILTER
+#define SHADOW_FILTER 0
+#endif
+
 struct Light {
   vec3 position;
   vec3 intensity;  
@@ -28,8 +49,12 @@ uniform vec3 ks;
 uniform float p;
 uniform int num_lights;
 uniform Light lights[MAX_NUM_LIGHTS];
+#if TEXTURED
 uniform sampler2D tex;
+#endif
+#if SHADOWS
 uniform sampler2DArrayShadow shadows;
+#endif
 
 layout(location = 0) out vec4 out_Fragmentcolor;
 
@@ -41,6 +66,35 @@ vec3 minf3(vec3 v1, vec3 v2) {
   );
 }
 
+/*
+ * How much of light i reaches the fragment, 0 or 1 with hard
+ * shadows. i'th index of 'shadows' should be set up so as to
+ * correspond to the i'th light in the scene.
+ */
+float shadow(int i, vec4 shadowCoords) {
+#if SHADOWS
+  vec3 uvz = shadowCoords.xyz / shadowCoords.w;
+#if SHADOW_FILTER == 1
+  /* 3x3 taps, each already a bilinear 2x2 comparison */
+  vec2 texel = 1.0 / vec2(textureSize(shadows, 0).xy);
+  float s = 0.0;
+  int x, y;
+  for (y=-1; y<=1; y++) {
+    for (x=-1; x<=1; x++) {
+      vec2 uv = uvz.xy + vec2(x, y) * texel;
+      s += texture(shadows, vec4(uv, float(i), uvz.z));
+    }
+  }
+  return s / 9.0;
+#else
+  float s = texture(shadows, vec4(uvz.xy, float(i), uvz.z));
+  return s > 0.0 ? 1.0 : 0.0;
+#endif
+#else
+  return 1.0;
+#endif
+}
+
 void main(void) {
   /* 
    * L = Lambertian, S = Specular, A = Ambience
@@ -58,36 +112,28 @@ void main(void) {
    *    texture returns (0,0,0) as color - since it is
    *    hidden in shadow
    */
+#if TEXTURED
   vec3 kdTexel = texture(tex, vTex).rgb;
+#endif
   vec3 c = vec3(0,0,0);
   vec3 l, n, v, h;
   vec3 intensity;
   int i;
-  int bound = min(num_lights, MAX_NUM_LIGHTS);
 
   float e = 2.0;
-  for (i=0; i<bound; i++) {
-    float w = vLights[i].shadowCoords.w;
-    vec3 uvz = vLights[i].shadowCoords.xyz / w;
-
+  for (i=0; i<LIGHT_COUNT; i++) {
     n = normalize(vNormal);
     v = normalize(vEye);
     h = normalize(vLights[i].h);
     l = normalize(vLights[i].l);
     intensity = lights[i].intensity;
 
-    /* 
-     * i'th index of 'shadows' should be set up
-     * so as to correspond to the i'th light 
-     * in the scene
-     */
-    float s = texture(shadows, vec4(uvz.xy, float(i), uvz.z));
-    if (s > 0.0) {
-      L = intensity * max(0, dot(n, l)); 
-      S = ks * intensity * pow(max(0, dot(n, h)), p); 
+    /* Weighted rather than branched on, so the loop stays flat */
+    float s = shadow(i, vLights[i].shadowCoords);
+    L = intensity * max(0, dot(n, l)); 
+    S = ks * intensity * pow(max(0, dot(n, h)), p); 
 
-      c += (L+S);
-    }
+    c += s * (L+S);
   }
 
   A = ka * Ia;
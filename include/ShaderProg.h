@@ -26,6 +26,25 @@ class ShaderProg {
       buf << ifs.rdbuf();
       code = buf.str();
     }
+
+    /*
+     * With "defines" (#define lines) inserted right after #version.
+     * "#line 2" keeps compiler messages pointing into the file.
+     */
+    ShaderProg(std::string n, GLuint t, const std::string &defines)
+      : ShaderProg(n, t)
+    {
+      if (defines.empty()) {
+        return;
+      }
+      if (code.compare(0, 8, "#version") != 0) {
+        code.insert(0, defines + "#line 1\n");
+        return;
+      }
+      size_t at = code.find('\n');
+      at = at == std::string::npos ? code.size() : at + 1;
+      code.insert(at, defines + "#line 2\n");
+    }
 };
 
 #endif
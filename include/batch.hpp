@@ -0,0 +1,43 @@
+#ifndef __RENDER_BATCH_H__
+#define __RENDER_BATCH_H__
+
+#include <string>
+#include <vector>
+
+#include "types_decl.h"
+
+/*
+ * Many views of one scene in one run, e.g. for dataset generation.
+ * The scene (OBJs, textures, shadow maps) is loaded once and every
+ * camera in the list is rendered offscreen in turn.
+ *
+ * Camera lists are JSON or CSV, picked by the file extension:
+ *
+ *   [ { "eye": "0 1 5", "gaze": "0 0 -1", "top": "0 1 0",
+ *       "fovy": 45 }, ... ]
+ *
+ *   # eye_x,eye_y,eye_z,gaze_x,gaze_y,gaze_z,top_x,top_y,top_z[,fovy]
+ *   0,1,5,0,0,-1,0,1,0,45
+ *
+ * Keys or columns which are left out keep the scene's own camera
+ * values. A CSV header line is skipped.
+ */
+namespace batch {
+  /* Cameras start as copies of "base". false on a malformed file */
+  bool load_cameras(const std::string &filepath,
+                    const Orientation &base,
+                    std::vector<Orientation> &cameras);
+
+  /*
+   * Render every camera into the renderer's offscreen target and
+   * write view i to the file printf(pattern, i), e.g. "view_%04d.png".
+   * The colour of view i is read back asynchronously while view i+1
+   * renders, and encoded on the screen:: writer threads.
+   */
+  void render(Scene &scene,
+              Renderer &renderer,
+              const std::vector<Orientation> &cameras,
+              const std::string &pattern);
+}
+
+#endif /* __RENDER_BATCH_H__ */
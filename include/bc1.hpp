@@ -0,0 +1,31 @@
+#ifndef __RENDER_BC1_H__
+#define __RENDER_BC1_H__
+
+#include <stddef.h>
+
+/*
+ * BC1 (S3TC DXT1) encoding of 8 bit RGB texels, 4x4 texels to an
+ * 8 byte block: two RGB565 endpoints and 2 bit indices into the
+ * four colours on the line between them. Always the opaque four
+ * colour mode (color0 > color1), so no texel decodes to black.
+ */
+namespace bc1 {
+  /* Bytes of a width x height level, partial blocks included */
+  size_t size(int width, int height);
+
+  /*
+   * Blocks of interleaved RGB "rgb" (GL order, bottom row first) in
+   * row order into "dst", size(width, height) bytes. Texels past the
+   * edge repeat the last row or column.
+   *
+   * Large levels are split into rows of blocks over "threads"
+   * threads, 0 for one per core.
+   */
+  void encode(const unsigned char *rgb,
+              int width,
+              int height,
+              unsigned char *dst,
+              int threads = 0);
+}
+
+#endif /* __RENDER_BC1_H__ */
@@ -0,0 +1,87 @@
+#ifndef __RENDER_BVH_H__
+#define __RENDER_BVH_H__
+
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "cull.hpp"
+
+/*
+ * Dynamic AABB tree over the world bounds of the scene's models.
+ *
+ * Every leaf holds one item (a model index) and a "fat" box, which
+ * is the item's bounds enlarged by margin. Small movements which
+ * stay inside the fat box do not touch the tree at all; larger ones
+ * remove and reinsert the leaf. Incremental inserts degrade the
+ * tree over time, so the SAH cost is tracked and the tree can be
+ * rebuilt top-down with a binned SAH split.
+ */
+class BVH {
+  public:
+    typedef struct Node {
+      glm::vec3 lo;
+      glm::vec3 hi;
+      int parent;
+      int child[2];
+      int item; /* -1 for internal nodes */
+    } Node;
+
+    float margin;
+
+    /* SAH cost of the tree right after the last rebuild() */
+    float built_cost;
+
+    BVH(float margin = 0.1f);
+
+    /* Discard the tree and build it from scratch over "bounds" */
+    void build(const cull::Bounds &bounds);
+    void rebuild();
+
+    void insert(int item, const glm::vec3 &center, const glm::vec3 &extent);
+    void remove(int item);
+
+    /*
+     * The bounds of "item" changed. Returns true when the item left
+     * its fat box and had to be reinserted.
+     */
+    bool update(int item, const glm::vec3 &center, const glm::vec3 &extent);
+
+    /*
+     * Set the bounds of "item" in place and enlarge its ancestors to
+     * fit, without changing the shape of the tree. Cheaper than
+     * update() but lets the tree quality drift.
+     */
+    void refit(int item, const glm::vec3 &center, const glm::vec3 &extent);
+
+    /* Sum over internal nodes of area(node) / area(root) */
+    float sah_cost() const;
+    size_t size() const { return count; }
+
+    void query_frustum(const cull::Frustum &f, std::vector<int> &out) const;
+    void query_aabb(const glm::vec3 &lo,
+                    const glm::vec3 &hi,
+                    std::vector<int> &out) const;
+
+    /* Items whose boxes are hit by the ray, nearest entry first */
+    void query_ray(const glm::vec3 &origin,
+                   const glm::vec3 &dir,
+                   float tmax,
+                   std::vector<int> &out) const;
+
+  private:
+    std::vector<Node> nodes;
+    std::vector<int> leaves; /* item -> leaf node */
+    int root;
+    int free_list;
+    size_t count;
+
+    int alloc_node();
+    void free_node(int id);
+    void insert_leaf(int leaf);
+    void remove_leaf(int leaf);
+    void fit_ancestors(int id);
+    void collect(int id, std::vector<int> &out) const;
+    int build_range(int *ids, int n, int parent);
+};
+
+#endif /* __RENDER_BVH_H__ */
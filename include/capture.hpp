@@ -0,0 +1,61 @@
+#ifndef __RENDER_CAPTURE_H__
+#define __RENDER_CAPTURE_H__
+
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "types_decl.h"
+
+/*
+ * Fly-through recording: a camera path is played back at a fixed
+ * timestep, frame f showing the path at time f / fps no matter how
+ * long it took to render, so the same path always gives the same
+ * frames. The path is a JSON array of keys in increasing time:
+ *
+ *   [ { "t": 0, "eye": "10 10 14", "target": "0 0 0" },
+ *     { "t": 4, "eye": "-14 6 10", "gaze": "1 -0.4 -0.7",
+ *       "fovy": 40 }, ... ]
+ *
+ * The eye follows a Catmull-Rom spline through the keys; gaze (or
+ * "target", the point looked at), top and fovy are interpolated
+ * between neighbouring keys. Keys without a value keep the scene's.
+ *
+ * Frames go to a numbered image sequence or, as raw BGR with the
+ * bottom row first, into the stdin of a command, e.g.
+ *
+ *   ffmpeg -f rawvideo -pix_fmt bgr24 -s 1400x900 -r 30 -i - \
+ *     -vf vflip fly.mp4
+ */
+namespace capture {
+  typedef struct Key {
+    float t;
+    glm::vec3 eye;
+    glm::vec3 gaze;
+    glm::vec3 top;
+    float fovy;
+  } Key;
+
+  /* false on a malformed file */
+  bool load_path(const std::string &filepath,
+                 const Orientation &base,
+                 std::vector<Key> &keys);
+
+  /* The camera at time t, clamped to the ends of the path */
+  Orientation sample(const std::vector<Key> &keys,
+                     const Orientation &base,
+                     float t);
+
+  /*
+   * Render the whole path at "fps". Frame f goes to the file
+   * printf(pattern, f), or to "pipe_cmd" when that is not empty.
+   */
+  void record(Scene &scene,
+              Renderer &renderer,
+              const std::vector<Key> &keys,
+              float fps,
+              const std::string &pattern,
+              const std::string &pipe_cmd);
+}
+
+#endif /* __RENDER_CAPTURE_H__ */
@@ -0,0 +1,64 @@
+#ifndef __RENDER_CULL_H__
+#define __RENDER_CULL_H__
+
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/mat4x4.hpp>
+
+namespace cull {
+  /*
+   * A frustum is stored as 6 planes (left, right, bottom, top,
+   * near, far). Each plane is (n.x, n.y, n.z, d) such that a
+   * point p is on the inside of the plane iff dot(n, p) + d >= 0.
+   */
+  typedef struct Frustum {
+    glm::vec4 planes[6];
+  } Frustum;
+
+  /*
+   * World-space axis-aligned bounding boxes of every model in
+   * the scene, stored as a structure of arrays (center, extent)
+   * so that several boxes can be tested against a plane at once.
+   * Index i corresponds to Scene::models[i].
+   */
+  class Bounds {
+    public:
+      std::vector<float> cx, cy, cz; /* Center */
+      std::vector<float> ex, ey, ez; /* Half extent */
+
+      size_t size() const { return cx.size(); }
+      void resize(size_t n);
+      void set(size_t i, const glm::vec3 &c, const glm::vec3 &e);
+  };
+
+  /*
+   * Extract the frustum planes from a projection*view matrix,
+   * i.e. the matrix which takes world coordinates to clip space.
+   */
+  Frustum frustum(const glm::mat4 &M);
+
+  /*
+   * Transform the local space AABB (lo, hi) by M and return the
+   * world space AABB enclosing it as (center, extent).
+   */
+  void transform_aabb(const glm::mat4 &M,
+                      const glm::vec3 &lo,
+                      const glm::vec3 &hi,
+                      glm::vec3 &center,
+                      glm::vec3 &extent);
+
+  bool aabb_in_frustum(const Frustum &f,
+                       const glm::vec3 &center,
+                       const glm::vec3 &extent);
+
+  /*
+   * Test every box in "bounds" against the frustum and write the
+   * indices of boxes which are (at least partially) inside into
+   * "visible", in increasing order.
+   */
+  void frustum_cull(const Bounds &bounds,
+                    const Frustum &f,
+                    std::vector<int> &visible);
+}
+
+#endif /* __RENDER_CULL_H__ */
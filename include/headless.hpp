@@ -0,0 +1,17 @@
+#ifndef __RENDER_HEADLESS_H__
+#define __RENDER_HEADLESS_H__
+
+/*
+ * OpenGL without a window or display server, for render farms and
+ * CI. Creates an EGL context on Mesa's surfaceless platform, or on
+ * the default display with a 1x1 pbuffer when that is missing, and
+ * loads glad through it. Everything is drawn into FBOs; software
+ * rendering (llvmpipe, LIBGL_ALWAYS_SOFTWARE=1) works as well.
+ */
+namespace headless {
+  /* Make a 4.3 core context current. false if EGL cannot */
+  bool init();
+  void terminate();
+}
+
+#endif /* __RENDER_HEADLESS_H__ */
@@ -0,0 +1,50 @@
+#ifndef __RENDER_HIERARCHY_H__
+#define __RENDER_HIERARCHY_H__
+
+#include <vector>
+#include <stdint.h>
+#include <glm/glm.hpp>
+#include <glm/mat4x4.hpp>
+
+/*
+ * Parent/child transform nodes, stored as a structure of arrays in
+ * topological order: a node's parent always has a smaller index.
+ * That lets update() compute every world matrix in one forward
+ * sweep,
+ *
+ *   world[i] = world[parent[i]] * local[i]
+ *
+ * with the parent already final when the child is reached. Only
+ * nodes which are dirty, or below a dirty node, are recomputed.
+ */
+class Hierarchy {
+  public:
+    Hierarchy();
+
+    /* "parent" must be -1 (a root) or an already added node */
+    int add(int parent, const glm::mat4 &local);
+
+    void set_local(int node, const glm::mat4 &local);
+
+    /* Recompute the world matrices of all dirty subtrees */
+    void update();
+
+    const glm::mat4 &world(int node) const { return world_[node]; }
+    int parent(int node) const { return parent_[node]; }
+    size_t size() const { return parent_.size(); }
+
+    /* Whether world(node) changed in the last update() */
+    bool updated(int node) const { return updated_[node] != 0; }
+
+  private:
+    std::vector<int> parent_;
+    std::vector<glm::mat4> local_;
+    std::vector<glm::mat4> world_;
+    std::vector<uint8_t> dirty_;
+    std::vector<uint8_t> updated_;
+
+    /* Nothing before this index is dirty */
+    size_t first_dirty;
+};
+
+#endif /* __RENDER_HIERARCHY_H__ */
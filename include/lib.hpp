@@ -2,6 +2,8 @@
 #define __RENDER_LIB_H__
 
 #include <vector>
+#include <string>
+#include <functional>
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 #include <glm/mat4x4.hpp>
@@ -64,10 +66,27 @@ void
 bind_vao(const std::vector<ld_o::VBO_STRUCT> &data,
          GLuint &VAO);
 
+/* 
+ * Bottom row first, interleaved RGB (channels 3) or RGBA (4), 
+ * cropped to powers of 2. Free with free().
+ */
 unsigned char *
 load_tex(const std::string &filepath,
          int &width,
-         int &height);
+         int &height,
+         int channels = 3);
+
+/*
+ * Start compiling and linking without waiting for the driver.
+ * bind_shaders() with the same sources picks the program up and
+ * only then checks for errors.
+ */
+void 
+prefetch_shaders(const std::vector<ShaderProg> &shader_progs);
+
+/* Delete what was prefetched and never bound */
+void
+discard_prefetched_shaders();
 
 void 
 bind_shaders(const std::vector<ShaderProg> &shader_progs,
@@ -81,38 +100,88 @@ GLuint
 load_shaders_simple(std::string nvs,
                     std::string nfs);
 
+GLuint
+load_shaders_compute(std::string ncs);
+void
+prefetch_shaders_simple(std::string nvs,
+                        std::string nfs);
+void
+prefetch_shaders_compute(std::string ncs);
+
 GLuint
 init_static_array_vbo(void *data, size_t size);
 
 GLuint
 init_array_VBO_STRUCT_vao(GLuint vbo, size_t stride);
 
+class Readback;
+class ImageWriter;
+
+/*
+ * Screenshots go through a Readback: each call only queues the
+ * copy. When the readback delivers it (its next poll() or flush())
+ * the pixels are handed to the shared ImageWriter, whose threads
+ * encode and write the file. The file extension picks the format.
+ */
 namespace screen {
   enum class ImageType {
     IMAGE_TYPE_RGB,
     IMAGE_TYPE_GREYSCALE
   };
 
+  enum class ImageFormat {
+    IMAGE_FORMAT_TGA_RLE, /* .tga */
+    IMAGE_FORMAT_PNG,     /* .png */
+    IMAGE_FORMAT_RAW      /* anything else: pixels exactly as read */
+  };
+
+  ImageFormat 
+  image_format(const std::string &path);
+
+  /* Writer threads shared by every screenshot, started on first use */
+  ImageWriter &
+  writer();
+
+  /* Block until every queued screenshot is on disk */
   void 
-  depth_2D_screenshot(const GLuint FBO,
+  finish();
+
+  typedef std::function<void(const unsigned char *data,
+                             size_t size)> ReadCallback;
+
+  void 
+  depth_2D_screenshot(Readback &readback,
+                      const GLuint FBO,
                       const GLenum mode,
                       const screen::ImageType type, 
                       const int width,
                       const int height,
                       const char *output_file);
 
-  unsigned char *
-  read_depth_tex_layer(const GLuint tex,
+  /* "done" gets width*height bytes of depth */
+  void 
+  read_depth_tex_layer(Readback &readback,
+                       const GLuint tex,
                        const int width,
                        const int height,
-                       const int layer);
+                       const int layer,
+                       const ReadCallback &done);
 
   void 
-  depth_3D_layer_screenshot(const GLuint tex,
+  depth_3D_layer_screenshot(Readback &readback,
+                            const GLuint tex,
                             const int width,
                             const int height,
                             const int layer,
                             const char *output_file);
+
+  void 
+  color_2D_screenshot(Readback &readback,
+                      const GLuint FBO,
+                      const GLenum mode,
+                      const int width,
+                      const int height,
+                      const char *output_file);
 }
 
 /* Make sure dimensions are the closest powers of 2 */
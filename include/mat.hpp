@@ -1,6 +1,7 @@
 #ifndef __RENDER_MAT_H__
 #define __RENDER_MAT_H__
 
+#include <stddef.h>
 #include <glm/glm.hpp>
 #include <glm/mat4x4.hpp>
 
@@ -17,8 +18,42 @@ namespace mat {
                       const glm::vec3 &t,
                       const glm::vec3 &e);
 
+  /*
+   * Rotation by theta (radians) about axis a, from the unit
+   * quaternion (cos(theta/2), sin(theta/2) * a) in closed form.
+   */
   glm::mat3 rot(const float &theta,
                      const glm::vec3 &a);
+
+  /*
+   * Inverse of a rigid transform [R | t], R orthonormal:
+   * [R^T | -R^T t]. Much cheaper than a general glm::inverse.
+   */
+  glm::mat4 rigid_inverse(const glm::mat4 &M);
+
+  /* out = a * b; out may alias neither */
+  void mul(const glm::mat4 &a, const glm::mat4 &b, glm::mat4 &out);
+
+  /* out[i] = a[i] * b[i] for n matrices */
+  void mul_batch(const glm::mat4 *a,
+                 const glm::mat4 *b,
+                 glm::mat4 *out,
+                 size_t n);
+
+  /* out[i] = a * b[i], e.g. one view-projection times many models */
+  void mul_batch(const glm::mat4 &a,
+                 const glm::mat4 *b,
+                 glm::mat4 *out,
+                 size_t n);
+
+  /*
+   * Model transform as composed by the scene format:
+   * rot(deg, axis) * scale(s) * translate(t)
+   */
+  glm::mat4 trs(const float deg,
+                const glm::vec3 &axis,
+                const glm::vec3 &s,
+                const glm::vec3 &t);
 }
 
 #endif /* __RENDER_MAT_H__ */
\ No newline at end of file
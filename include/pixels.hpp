@@ -0,0 +1,57 @@
+#ifndef __RENDER_PIXELS_H__
+#define __RENDER_PIXELS_H__
+
+#include <stddef.h>
+
+/*
+ * 8 bit image layout conversions for texture loading. CImg keeps
+ * images planar (every channel a whole plane, top row first); GL
+ * wants interleaved texels, bottom row first.
+ */
+namespace pixels {
+  /* dst = r0 g0 b0 r1 g1 b1 ..., n pixels */
+  void interleave(const unsigned char *r,
+                  const unsigned char *g,
+                  const unsigned char *b,
+                  unsigned char *dst,
+                  size_t n);
+
+  /* dst = r0 g0 b0 a0 ..., opaque when "a" is NULL */
+  void interleave(const unsigned char *r,
+                  const unsigned char *g,
+                  const unsigned char *b,
+                  const unsigned char *a,
+                  unsigned char *dst,
+                  size_t n);
+
+  /*
+   * The top-left width x height of a planar image ("planes":
+   * "channels" planes of stride x rows pixels) as interleaved rows
+   * for GL, bottom row first, with 3 (RGB) or 4 (RGBA) channels
+   * "out". Grey images are spread over RGB, missing alpha is 255.
+   *
+   * Large images are split into blocks of rows over "threads"
+   * threads, 0 for one per core.
+   */
+  void planar_to_gl(const unsigned char *planes,
+                    int stride,
+                    int rows,
+                    int channels,
+                    int width,
+                    int height,
+                    int out,
+                    unsigned char *dst,
+                    int threads = 0);
+
+  /*
+   * Next mip level of interleaved "src": half the size (at least
+   * 1 x 1), each texel the mean of a 2x2 box
+   */
+  void downsample(const unsigned char *src,
+                  int width,
+                  int height,
+                  int channels,
+                  unsigned char *dst);
+}
+
+#endif /* __RENDER_PIXELS_H__ */
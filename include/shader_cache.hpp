@@ -0,0 +1,32 @@
+#ifndef __RENDER_SHADER_CACHE_H__
+#define __RENDER_SHADER_CACHE_H__
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <glad/glad.h>
+
+#include "ShaderProg.h"
+
+/*
+ * Linked program binaries on disk (glGetProgramBinary), so later
+ * runs skip compiling and linking. The key hashes every stage's
+ * type and source (defines included, as they are part of the
+ * source) together with the driver's vendor, renderer and version
+ * strings; a driver update or an edited shader just misses.
+ *
+ * Binaries the driver rejects are treated as misses too: the
+ * caller compiles from source as usual and stores the new binary.
+ */
+namespace shader_cache {
+  /* 0 when the driver offers no binary formats */
+  uint64_t key(const std::vector<ShaderProg> &shader_progs);
+
+  /* A linked program from the cache, or 0 on a miss */
+  GLuint load(uint64_t key);
+
+  /* "prog" must be linked with GL_PROGRAM_BINARY_RETRIEVABLE_HINT */
+  void store(uint64_t key, GLuint prog);
+}
+
+#endif /* __RENDER_SHADER_CACHE_H__ */
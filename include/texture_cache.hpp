@@ -0,0 +1,42 @@
+#ifndef __RENDER_TEXTURE_CACHE_H__
+#define __RENDER_TEXTURE_CACHE_H__
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <glad/glad.h>
+
+/*
+ * Encoded texture mip chains on disk as KTX 1.1 files, so later
+ * runs skip decoding and encoding and upload straight from a
+ * read-only mapping. The key hashes the image file's path, size and
+ * modification time with the format and whether the chain has
+ * mipmaps; an edited image just misses.
+ *
+ * Levels are stored bottom row first, as GL takes them (KTX
+ * orientation "S=r,T=u").
+ */
+namespace texture_cache {
+  typedef struct Image {
+    GLenum format; /* Internal format, e.g. GL_COMPRESSED_RGB_S3TC_DXT1_EXT */
+    int width;
+    int height;
+    std::vector<const unsigned char *> levels;
+    std::vector<size_t> sizes; /* Bytes of each level */
+
+    void *map; /* Mapping "levels" point into, NULL if not from load() */
+    size_t map_size;
+  } Image;
+
+  /* 0 when "file" cannot be stat'ed */
+  uint64_t key(const std::string &file, GLenum format, bool mipmaps);
+
+  /* Maps the cached chain into "image", false on a miss */
+  bool load(uint64_t key, Image &image);
+  /* Unmaps what load() mapped */
+  void release(Image &image);
+
+  void store(uint64_t key, const Image &image);
+}
+
+#endif /* __RENDER_TEXTURE_CACHE_H__ */
@@ -0,0 +1,79 @@
+#ifndef __RENDER_TRACE_H__
+#define __RENDER_TRACE_H__
+
+#include <string>
+#include <stdint.h>
+
+/*
+ * Scoped timing zones, written out as Chrome trace_event JSON
+ * (chrome://tracing, ui.perfetto.dev).
+ *
+ *   void load_obj(...) {
+ *     TRACE_ZONE("load_obj");
+ *     TRACE_ZONE_DETAIL("parse", filepath);
+ *     ...
+ *   }
+ *
+ * Each thread appends to its own buffer under that buffer's own
+ * mutex, which is uncontended unless write() is copying it out;
+ * the registry mutex is only taken the first time a thread records.
+ * Zones are dropped until trace::start() is called. Building with
+ * RENDER_TRACE=0 compiles every zone out.
+ */
+#ifndef RENDER_TRACE
+  #define RENDER_TRACE 1
+#endif
+
+namespace trace {
+  void start();
+  void stop();
+  bool active();
+
+  /* Microseconds since an arbitrary fixed point */
+  int64_t now_us();
+
+  /* "name" must outlive the trace, i.e. be a literal */
+  void record(const char *name, 
+              const std::string &detail, 
+              int64_t begin_us, 
+              int64_t end_us);
+
+  /*
+   * Write everything recorded so far; threads may keep recording
+   * meanwhile. Returns false if the file could not be opened.
+   */
+  bool write(const std::string &filename);
+
+  class Zone {
+    public:
+      Zone(const char *name) 
+        : name(name), begin(active() ? now_us() : -1) {}
+      Zone(const char *name, const std::string &detail) 
+        : name(name), detail(detail), begin(active() ? now_us() : -1) {}
+      ~Zone() {
+        if (begin >= 0) {
+          record(name, detail, begin, now_us());
+        }
+      }
+
+    private:
+      const char *name;
+      std::string detail;
+      int64_t begin;
+  };
+}
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+#if RENDER_TRACE
+  #define TRACE_ZONE(name) \
+    trace::Zone TRACE_CONCAT(_trace_zone_, __LINE__)(name)
+  #define TRACE_ZONE_DETAIL(name, detail) \
+    trace::Zone TRACE_CONCAT(_trace_zone_, __LINE__)(name, detail)
+#else
+  #define TRACE_ZONE(name)
+  #define TRACE_ZONE_DETAIL(name, detail)
+#endif
+
+#endif /* __RENDER_TRACE_H__ */
@@ -4,12 +4,22 @@
 #include <string>
 #include <sstream>
 #include <fstream>
+#include <chrono>
+#include <functional>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
 #include <nlohmann/json.hpp>
 #include <glm/geometric.hpp>
 #include <glm/mat4x4.hpp>
 #include <glm/glm.hpp>
 
 #include "lib.hpp"
+#include "cull.hpp"
+#include "bvh.hpp"
+#include "hierarchy.hpp"
+#include "texture_cache.hpp"
 #include "types_decl.h"
 
 
@@ -28,14 +38,54 @@ class Scene {
     int p;
 
     ShadowMap *shadowMap;
+    /*
+     * Streams "textures" in after the constructor returns, with mip
+     * chains ("mipmaps", default on), BC1 compression
+     * ("texture_compression", default on) and "anisotropy" from the
+     * file
+     */
+    TextureStreamer *streamer;
+
+    /* Two-phase Hi-Z occlusion culling of the main pass */
+    bool occlusion_culling;
+    /* Lay down depth first, then shade with GL_EQUAL */
+    bool depth_prepass;
+    /* Bin lights into view space clusters instead of MAX_NUM_LIGHTS */
+    bool clustered;
+    /* Forward pass shadow lookups, hard or 3x3 PCF filtered */
+    bool shadows;
+    bool shadow_pcf;
+    /* G-buffer + screen space lighting instead of forward shading */
+    bool deferred;
+    /* Sleep in glfwWaitEvents until input or the scene changes */
+    bool on_demand;
+    /* Time every pass, see PassTimer */
+    bool profile;
+    std::string profile_csv;
+    /* Frame rate cap (0 = default), vsync, or no cap at all */
+    float fps;
+    bool vsync;
+    bool uncapped;
 
     std::unordered_map<std::string, Texture *> textures;
     std::unordered_map<std::string, Data *> objects;
     std::vector<Model *> models;
 
+    /* "nodes" of the scene file, models hang off them by "parent" */
+    Hierarchy hierarchy;
+    std::unordered_map<std::string, int> nodes;
+
+    /* World space bounds of models[i] at index i */
+    cull::Bounds bounds;
+    BVH bvh;
+
     Scene() {}
     Scene(std::string, int, int);
 
+    void update_transforms();
+    bool update_bounds();
+    void cull_models(const cull::Frustum &, std::vector<int> &visible);
+
     const GLfloat *Kd();
     const GLfloat *Ka();
     const GLfloat *Ks();
@@ -53,29 +103,663 @@ class ShadowMap {
 	public:
 		GLuint fbo;
 		GLuint tex;
+		GLuint prog;
+		int width;
+		int height;
+		int renders;
+
+		/* Models which survived culling for the light being rendered */
+		std::vector<int> visible;
 
-		ShadowMap(std::vector<Light> &lights,
-						  std::vector<Model *> &models,
+		ShadowMap(Scene &scene,
 							int width,
 							int height,
 							std::string nvs,
 							std::string nfs);
+
+		/* Each light's layer is timed as a pass when "timer" is given */
+		void render(Scene &scene, PassTimer *timer = NULL);
 };
 
-class Model {
+/*
+ * Offscreen color + depth target. The main pass renders here
+ * instead of the default framebuffer whenever a later pass needs
+ * to sample its depth (e.g. to build the Hi-Z pyramid).
+ */
+class RenderTarget {
   public:
-    glm::mat4 model_; 
+    GLuint fbo;
+    GLuint color;
+    GLuint depth;
+    int width;
+    int height;
+
+    RenderTarget(int width, int height);
+    ~RenderTarget();
+
+    void bind();
+    /* Copy color into FBO (0 is the window's back buffer) */
+    void blit(GLuint FBO);
+};
+
+/*
+ * Asynchronous GPU -> CPU copies. A read is queued into a pixel
+ * pack buffer with a fence behind it and returns at once; the
+ * buffer is mapped and handed to the read's callback a frame or
+ * two later, once the fence has signalled. Callbacks run on the
+ * GL thread from poll(), flush() or a read that needs the slot,
+ * always in the order the reads were queued. "data" is only valid
+ * inside the callback.
+ *
+ * With every slot in flight the next read waits for the oldest,
+ * so at most "slots" copies are ever outstanding.
+ */
+class Readback {
+  public:
+    typedef std::function<void(const unsigned char *data, 
+                               size_t size)> Callback;
+
+    /* Reads which had to wait for the GPU to catch up */
+    size_t stalls;
+
+    Readback(int slots = 3);
+    ~Readback(); /* Delivers whatever is still in flight */
+
+    /* glReadPixels of "mode" (e.g. GL_COLOR_ATTACHMENT0) of FBO */
+    void read_pixels(GLuint FBO, GLenum mode,
+                     int width, int height,
+                     GLenum format, GLenum type, size_t size,
+                     const Callback &done);
+
+    /* glGetTextureSubImage of one layer of a 2D or 2D array texture */
+    void read_texture(GLuint tex, int layer,
+                      int width, int height,
+                      GLenum format, GLenum type, size_t size,
+                      const Callback &done);
+
+    /* Deliver every read which has finished, without waiting */
+    void poll();
+    /* Wait for and deliver every read in flight */
+    void flush();
+
+  private:
+    typedef struct Slot {
+      GLuint pbo;
+      size_t capacity;
+      size_t size;
+      GLsync fence;
+      Callback done;
+    } Slot;
+
+    std::vector<Slot> ring;
+    size_t head; /* Next slot to queue into */
+    size_t tail; /* Oldest slot in flight */
+    size_t in_flight;
+
+    /* Make the head slot free and at least "size" bytes */
+    Slot &acquire(size_t size);
+    void submit(Slot &slot, const Callback &done);
+    /* Hand the oldest read to its callback; false if none is ready */
+    bool deliver(bool wait);
+};
+
+/*
+ * Image files are encoded and written by a pool of worker threads,
+ * so neither compression nor disk I/O happens on the GL thread.
+ *
+ *   std::vector<unsigned char> *buf = writer.acquire(size);
+ *   ... fill buf ...
+ *   writer.submit(buf, width, height, type, format, path);
+ *
+ * Buffers come from a fixed pool and go back to it once written.
+ * When every buffer is queued, acquire() blocks until a worker
+ * frees one: a capture which outruns the disk slows the renderer
+ * down instead of dropping frames or growing without bound.
+ */
+class ImageWriter {
+  public:
+    typedef std::vector<unsigned char> Buffer;
+
+    /* acquire() calls which had to wait for a free buffer */
+    size_t stalls;
+
+    ImageWriter(int threads, int buffers);
+    ~ImageWriter(); /* Writes everything still queued */
+
+    /* A pool buffer resized to "size" bytes */
+    Buffer *acquire(size_t size);
+
+    /*
+     * Encode "buf" (as read by GL: bottom row first, BGR or grey,
+     * tightly packed) to "path". "buf" belongs to the writer again.
+     */
+    void submit(Buffer *buf,
+                int width,
+                int height,
+                screen::ImageType type,
+                screen::ImageFormat format,
+                const std::string &path);
+
+    /*
+     * Append "buf" to "stream" as is, e.g. raw video frames into a
+     * pipe. A writer with one thread keeps them in submit order.
+     */
+    void submit(Buffer *buf, FILE *stream);
+
+    /* Block until every submitted image is on disk */
+    void wait();
+
+  private:
+    typedef struct Job {
+      Buffer *buf;
+      int width;
+      int height;
+      screen::ImageType type;
+      screen::ImageFormat format;
+      std::string path;
+      FILE *stream; /* Instead of "path" when not NULL */
+    } Job;
+
+    std::vector<std::thread> workers;
+    std::deque<Job> jobs;
+    std::vector<Buffer *> pool;  /* Every buffer, for the destructor */
+    std::vector<Buffer *> idle;  /* Buffers free to acquire */
+    size_t max_buffers;
+    int writing;
+    bool stop;
+
+    std::mutex lock;
+    std::condition_variable queued;   /* jobs not empty, or stop */
+    std::condition_variable released; /* A buffer became idle */
+
+    void run();
+};
+
+/*
+ * Textures loaded off the GL thread. Worker threads decode the
+ * image files; poll() on the GL thread copies decoded rows into a
+ * persistently mapped pixel unpack buffer and uploads them from
+ * there, only so many bytes per call, so a big texture set streams
+ * in over a few frames instead of stalling one.
+ *
+ * The unpack buffer is a ring of slots. A slot is written again
+ * once the fence behind its last upload has signalled; until then
+ * poll() stops for the frame and flush() waits.
+ *
+ * With "mipmaps", the workers also box filter the full mip chain,
+ * which is streamed in after level 0, and textures are sampled
+ * trilinearly; "anisotropy" above 1 turns on anisotropic filtering
+ * on top (clamped to what the driver offers).
+ *
+ * With "compress" and EXT_texture_compression_s3tc, every level is
+ * encoded to BC1 on the workers (4x smaller than RGB in memory and
+ * in the ring) and kept in the texture cache; later runs map the
+ * cached chain instead of decoding. Without the extension textures
+ * stay uncompressed. These settings apply to textures loaded after
+ * they are set.
+ *
+ * A texture shows a shared 1x1 placeholder until all of it is
+ * uploaded, then its "id" switches to the real texture. Textures
+ * must outlive their upload.
+ */
+class TextureStreamer {
+  public:
+    /* Uploads which found their slot still in use by the GPU */
+    size_t stalls;
+
+    bool mipmaps;
+    float anisotropy;
+    bool compress;
+
+    TextureStreamer(int threads = 2,
+                    int slots = 4,
+                    size_t slot_size = 4 << 20);
+    ~TextureStreamer();
+
+    /* Queue "tex" (tex->file) for decoding and upload */
+    void load(Texture *tex);
+
+    /*
+     * Upload about "budget" bytes of decoded textures without
+     * waiting on anything; true if a texture became complete.
+     */
+    bool poll(size_t budget);
+    /* Wait for and upload everything queued */
+    void flush();
+
+    /* Textures queued and not complete yet */
+    size_t pending() const { return outstanding; }
+
+    /* Bound in place of textures still loading */
+    static GLuint placeholder();
+
+  private:
+    typedef struct Slot {
+      size_t offset; /* Into pbo */
+      GLsync fence;
+    } Slot;
+
+    typedef struct Upload {
+      Texture *tex;
+      /* load_tex() rows, bottom up; NULL if compressed */
+      unsigned char *data;
+      /* Levels 1.., or all levels once compressed, back to back */
+      std::vector<unsigned char> mips;
+      /* Format, size and where each level is (maybe a cache map) */
+      texture_cache::Image image;
+      bool mipmaps;
+      bool compress;
+      float anisotropy;
+      GLuint id;
+      int level; /* Level being uploaded */
+      int row;   /* Rows (of blocks, if compressed) of it uploaded */
+    } Upload;
+
+    GLuint pbo;
+    unsigned char *mapped; /* Persistent mapping, NULL if unsupported */
+    std::vector<Slot> ring;
+    size_t slot_size;
+    size_t head;
+
+    Upload current;
+    bool active;
+    size_t outstanding;
+
+    /* Decoding, shared with the workers */
+    std::vector<std::thread> workers;
+    std::deque<Upload> queue;
+    std::deque<Upload> decoded;
+    bool stop;
+
+    std::mutex lock;
+    std::condition_variable queued;  /* queue not empty, or stop */
+    std::condition_variable ready;   /* A texture was decoded */
+
+    void run();
+    /* Fill in u.image on a worker, see TextureStreamer.cpp */
+    static void decode(Upload &u);
+    /* Upload until "budget" is spent or nothing is left to do */
+    bool upload(size_t budget, bool wait);
+};
+
+/*
+ * Hierarchical-Z occlusion culling, all on the GPU:
+ *  phase 1: draw what was visible last frame (cmds[0..n))
+ *  build:   max-depth mip chain of the resulting depth buffer
+ *  cull:    test every model's bounds against the pyramid, write
+ *           this frame's visibility into cmds[0..n) and the newly
+ *           visible models into cmds[n..2n)
+ *  phase 2: draw the newly visible models
+ * Draws go through glDrawArraysIndirect so the CPU never reads
+ * the visibility back.
+ */
+class OcclusionCuller {
+  public:
+    enum Phase { PHASE_1 = 0, PHASE_2 = 1 };
+
+    typedef struct DrawCmd {
+      GLuint count;
+      GLuint instanceCount;
+      GLuint first;
+      GLuint baseInstance;
+    } DrawCmd;
+
+    GLuint hiz;
+    int width;
+    int height;
+    int levels;
+
+    GLuint bounds_buf;
+    GLuint cmd_buf;
+    size_t num_models;
+
+    GLuint init_prog;
+    GLuint downsample_prog;
+    GLuint cull_prog;
+
+    OcclusionCuller(int width, int height);
+    ~OcclusionCuller();
+
+    /* Start compiling the programs, see prefetch_shaders() */
+    static void prefetch_programs();
+
+    /* (Re)upload model bounds and vertex counts */
+    void upload(Scene &scene);
+    /* Bounds only, for moved models; last frame's visibility stays */
+    void update_bounds(const Scene &scene);
+    void build_hiz(GLuint depth_tex);
+    void cull(const glm::mat4 &viewProj);
+
+    /* Byte offset of model i's command for glDrawArraysIndirect */
+    const void *cmd(int i, Phase phase);
+};
+
+/*
+ * Per pass GPU and CPU times. Each begin()/end() pair brackets a
+ * named pass with two GL_TIMESTAMP queries (so passes may nest)
+ * and a CPU clock. Queries of a frame are read back RING frames
+ * later, when the GPU is long done with them; results which are
+ * still not available then are dropped instead of waited on.
+ * A disabled timer does nothing at all.
+ */
+class PassTimer {
+  static const int RING = 4;
+  typedef std::chrono::steady_clock clock;
+  public:
+    typedef struct Stats {
+      std::string name;
+      double gpu_ms;      /* Averages since the last reset() */
+      double cpu_ms;
+      double last_gpu_ms; /* Most recent sample */
+      double last_cpu_ms;
+      size_t samples;
+    } Stats;
+
+    bool enabled;
+
+    PassTimer(bool enabled);
+    ~PassTimer();
+
+    /* Start a frame, collecting the one issued RING frames ago */
+    void frame();
+    void begin(const std::string &name);
+    /* Ends the innermost open pass */
+    void end();
+
+    const std::vector<Stats> &stats() const { return passes; }
+    long frame_count() const { return frames; }
+    void reset();
+
+    void print(FILE *f);
+    void write_csv(FILE *f);
+
+  private:
+    typedef struct Zone {
+      int pass;
+      GLuint queries[2];
+      double cpu_ms;
+    } Zone;
+
+    typedef struct Slot {
+      std::vector<Zone> zones; /* Grows, queries are reused */
+      size_t used;
+    } Slot;
+
+    Slot slots[RING];
+    long frames;
+    bool csv_header;
+
+    std::vector<Stats> passes;
+    std::unordered_map<std::string, int> ids;
+    std::vector<size_t> open;
+    std::vector<clock::time_point> started;
+};
+
+/*
+ * Counts the samples passing the depth test between begin() and
+ * end(), i.e. the fragments which were shaded. Queries are kept
+ * in a ring and only read once the GPU has made them available,
+ * so the count lags a couple of frames but never stalls.
+ */
+class SampleCounter {
+  static const int RING = 4;
+  public:
+    GLuint queries[RING];
+    int frame;
+
+    /* Most recent available result and running totals */
+    GLuint64 last;
+    GLuint64 total;
+    int frames;
+
+    SampleCounter();
+    ~SampleCounter();
+
+    void begin();
+    void end();
+};
+
+/*
+ * Paces frames against absolute deadlines 1/fps apart: sleeps
+ * until shortly before the deadline, then spins the rest, since
+ * sleep_for alone overshoots by up to a scheduler tick. With fps
+ * of 0 it never waits. Either way it records how long each frame
+ * took from begin() to end(), for min/avg/p99 reports over the
+ * last HISTORY frames.
+ */
+class FramePacer {
+  typedef std::chrono::steady_clock clock;
+  static const size_t HISTORY = 1024;
+  public:
+    typedef struct Stats {
+      size_t frames;
+      double min_ms;
+      double avg_ms;
+      double p99_ms;
+    } Stats;
+
+    FramePacer(float fps);
+
+    void begin();
+    void end();
+    /* Block until the next frame's deadline */
+    void wait();
+
+    Stats stats() const;
+    size_t frames() const { return times.size(); }
+    void reset() { times.clear(); next = 0; }
+
+  private:
+    clock::duration period;
+    clock::time_point deadline;
+    clock::time_point start;
+    std::vector<double> times; /* ms, a ring once HISTORY long */
+    size_t next;
+};
+
+/*
+ * Clustered forward lighting. The view frustum is split into
+ * X*Y screen tiles and Z exponential depth slices; every frame the
+ * lights are binned into the clusters their sphere of influence
+ * touches. The fragment shader then only loops over the lights of
+ * its own cluster:
+ *   binding 0: lights[]         (GPULight)
+ *   binding 1: clusters[]       (offset, count) into indices
+ *   binding 2: light_indices[]
+ */
+class ClusterGrid {
+  public:
+    static const int X = 16;
+    static const int Y = 9;
+    static const int Z = 24;
+
+    typedef struct GPULight {
+      glm::vec4 position; /* w = radius */
+      glm::vec4 intensity;
+      glm::mat4 shadowMat;
+    } GPULight;
 
+    GLuint light_buf;
+    GLuint cluster_buf;
+    GLuint index_buf;
+
+    int width;
+    int height;
+
+    ClusterGrid(int width, int height);
+    ~ClusterGrid();
+
+    /* Re-bin scene.lights_ for the current camera and upload */
+    void update(Scene &scene);
+    /* Bind the buffers and set the grid uniforms of "prog" */
+    void bind(GLuint prog);
+
+  private:
+    /* View space AABB of every cluster, rebuilt on projection change */
+    std::vector<glm::vec3> lo;
+    std::vector<glm::vec3> hi;
+    float fovy, aspect, zNear, zFar;
+
+    std::vector<GPULight> lights;
+    std::vector<GLuint> clusters;
+    std::vector<GLuint> indices;
+    std::vector<std::vector<GLuint> > bins;
+
+    void build_clusters(float fovy, float aspect, float n, float f);
+};
+
+/*
+ * Deferred shading. The geometry pass writes, per pixel:
+ *   albedo: RGBA8 - texel, or the scene's Kd for untextured models
+ *   normal: RG16F - world space normal, octahedron encoded
+ *   depth:  32F   - world position is reconstructed from it
+ * and the lighting pass then runs Blinn-Phong + shadows once per
+ * covered pixel, with the lights of the pixel's ClusterGrid cluster.
+ */
+class GBuffer {
+  static GLenum DRAW_BUFFERS[2];
+  public:
+    GLuint fbo;
+    GLuint albedo;
+    GLuint normal;
+    GLuint depth;
+    /* Empty, core profile needs one bound for the full screen pass */
+    GLuint vao;
+
+    GLuint geometry_prog;
+    GLuint lighting_prog;
+
+    int width;
+    int height;
+
+    GBuffer(int width, int height);
+    ~GBuffer();
+
+    /* Start compiling the programs, see prefetch_shaders() */
+    static void prefetch_programs();
+
+    /* Bind and clear the G-buffer, make the geometry program current */
+    void begin(Scene &scene, const glm::mat4 &viewProj);
+    void bind_model(Model *model);
+
+    /* Light every covered pixel into FBO (0 is the window) */
+    void shade(Scene &scene,
+               ClusterGrid &clusters,
+               const glm::mat4 &viewProj,
+               GLuint FBO);
+};
+
+/*
+ * One vertex + fragment shader pair specialized by blocks of
+ * #defines (see ShaderProg). Each distinct block is its own
+ * program, compiled the first time a draw asks for it and kept
+ * for the rest of the run.
+ */
+class ShaderVariants {
+  public:
+    std::string vs;
+    std::string fs;
+
+    ShaderVariants(std::string vs, std::string fs);
+    ~ShaderVariants();
+
+    /* Start compiling a variant, see prefetch_shaders() */
+    static void prefetch(const std::string &vs,
+                         const std::string &fs,
+                         const std::string &defines);
+
+    /* 0 when the variant failed to compile */
+    GLuint get(const std::string &defines);
+
+  private:
+    std::unordered_map<std::string, GLuint> programs;
+};
+
+/*
+ * Everything that draws one frame of the scene from its current
+ * camera: the shading path picked by the scene file (forward,
+ * clustered or deferred), culling, and the target it draws into.
+ * The window loop, headless and batch rendering all go through it.
+ */
+class Renderer {
+  public:
+    int width;
+    int height;
+    /* Frames stay in target instead of being blitted to the window */
+    bool offscreen;
+
+    GLuint prog_id; /* Clustered program, 0 otherwise */
+    ShaderVariants *forward; /* Forward programs, NULL otherwise */
+    ClusterGrid *clusters;
+    GBuffer *gbuffer;
+    RenderTarget *target;
+    OcclusionCuller *occlusion;
+    GLuint depth_tex; /* Main pass depth, fed to occlusion culling */
+
+    SampleCounter shaded;
+    PassTimer timer;
+    std::vector<int> visible;
+
+    Renderer(Scene &scene, int width, int height, bool offscreen);
+    ~Renderer();
+
+    /* Start compiling what a Renderer for "scene" will bind */
+    static void prefetch_programs(const Scene &scene);
+
+    /*
+     * Apply transform changes and stream in textures; returns
+     * whether the frame looks different for it
+     */
+    bool update(Scene &scene);
+    void render(Scene &scene);
+};
+
+/*
+ * Transforms are kept decomposed as rotation, scale, translate and
+ * only turned into a matrix when one of them changed. Static models
+ * cost nothing per frame past the first.
+ */
+class Model {
+  public:
     Texture *tex_;
     Data *data_;
 
+    Model(Data *, Texture *, float, std::string, std::string, std::string);
+    const GLfloat *model();
+    void bounds(glm::vec3 &center, glm::vec3 &extent);
+
+    /* True until bounds() has seen the latest transform */
+    bool moved() const { return moved_; }
+
+    float rotationDeg() const { return rotationDeg_; }
+    const glm::vec3 &rotationAxis() const { return rotationAxis_; }
+    const glm::vec3 &scale() const { return scale_; }
+    const glm::vec3 &translate() const { return translate_; }
+
+    void set_rotation(float deg, const glm::vec3 &axis);
+    void set_scale(const glm::vec3 &s);
+    void set_translate(const glm::vec3 &t);
+
+    /* Scene::hierarchy node the model hangs off, -1 for none */
+    int node() const { return node_; }
+    void set_node(int node) { node_ = node; }
+    /* World matrix of that node, applied after the model's own TRS */
+    void set_parent(const glm::mat4 &world);
+
+  private:
+    glm::mat4 model_; 
+    glm::vec3 center_;
+    glm::vec3 extent_;
+
     float rotationDeg_;
     glm::vec3 rotationAxis_;
     glm::vec3 scale_;
     glm::vec3 translate_;
+    glm::mat4 parent_;
+    int node_;
 
-    Model(Data *, Texture *, float, std::string, std::string, std::string);
-    const GLfloat *model();
+    bool dirty_;  /* model_ is stale */
+    bool moved_;  /* center_, extent_ are stale */
 };
 
 class Light {
@@ -87,6 +771,9 @@ class Light {
     glm::vec3 position;
     glm::vec3 intensity;
 
+    /* Range of influence for clustered lighting, 0 = unbounded */
+    float radius;
+
     Light(std::string p, std::string i, glm::vec3 t, int w, int h);
     glm::mat4 Mvp_bias();
     glm::mat4 Mvp();
@@ -107,6 +794,8 @@ class Texture {
     int layers;
 
     Texture(std::string);
+    /* Decoded and uploaded in the background, see TextureStreamer */
+    Texture(std::string, TextureStreamer &);
     Texture();
     ~Texture();
 };
@@ -139,6 +828,10 @@ class Data {
     GLuint vbo;
     GLuint vao;
 
+    /* Object space bounding box */
+    glm::vec3 bbox_min;
+    glm::vec3 bbox_max;
+
     Data(const char *);
 
     void print();
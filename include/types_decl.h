@@ -11,4 +11,16 @@ class Light;
 class Orientation;
 class Texture;
 class Data;
-class ShadowMap;
\ No newline at end of file
+class ShadowMap;
+class RenderTarget;
+class Readback;
+class ImageWriter;
+class TextureStreamer;
+class OcclusionCuller;
+class SampleCounter;
+class ClusterGrid;
+class GBuffer;
+class ShaderVariants;
+class FramePacer;
+class PassTimer;
+class Renderer;
\ No newline at end of file
@@ -7,6 +7,7 @@
 #include <stdio.h>
 #include <chrono>
 #include <thread>
+#include <functional>
 
 /*
  glad is the OpenGL library loader, basically, it discovers where all the
@@ -28,12 +29,20 @@
 #include "helpers.h"
 #include "lib.hpp"
 #include "mat.hpp"
+#include "cull.hpp"
+#include "trace.hpp"
+#include "headless.hpp"
+#include "batch.hpp"
+#include "capture.hpp"
 
 // Custom header files
 #include "ShaderProg.h"
 #include "types.hpp"
 
-#define _DEBUG_LOOP_LOGS_ 0
+#define FRAME_STATS_FRAMES 300 /* Report uncapped frame times this often */
+#define PROFILE_FRAMES 300 /* Dump pass times this often */
+#define TRACE_FRAMES 600 /* Frames in the trace after startup */
+#define STREAM_POLL_S 0.01 /* On demand wake-ups while textures stream in */
 // #define DEBUG_MODE
 
 #ifndef DEBUG_MODE
@@ -42,19 +51,15 @@
   #define FPS 1 
 #endif
 
-#define MAX_MS_PER_FRAME 1000 / FPS /* milliseconds per frame */
 #define WIDTH_PIXELS 1400 
 #define HEIGHT_PIXELS 900 
 #define DEG_TO_RAD 0.0174533
 
-#define time_p std::chrono::high_resolution_clock::time_point
-#define duration std::chrono::duration
-#define clock std::chrono::high_resolution_clock
-#define duration_cast std::chrono::duration_cast
-
 Scene scene;
 glm::vec2 *last_cursor_pos = NULL;
 bool LEFT_MOUSE_BTN_PRESSED = false;
+/* Something on screen changed since the last frame was drawn */
+bool FRAME_DIRTY = true;
 
 void window_callback_scroll(const double &xoffset, const double &yoffset) {
   // Get direction of gaze, and adjust towards/away that direction
@@ -66,6 +71,7 @@ void window_callback_scroll(const double &xoffset, const double &yoffset) {
   } else {
     orient->eye = orient->eye-_d;
   }
+  FRAME_DIRTY = true;
 }
 
 void window_callback_mouse_btn(int btn, int action, int mods) {
@@ -128,168 +134,280 @@ void window_callback_cursor_pos(float xpos, float ypos) {
 
   // Finally, reset prev (i.e. last_cursor_pos)
   *prev = curr;
+  FRAME_DIRTY = true;
 }
 
 int main(int argc, char *argv[]) {
-  if (argc != 2) {
+  /*
+   * --headless renders without a window: --frames images of the
+   * scene's camera are written to <output>_0000.<format> and on.
+   * --cameras renders one image per camera in the list instead,
+   * and implies --headless. Formats are tga (RLE), png and raw.
+   * --camera-path records a fly-through at --rate frames per second
+   * of path time, to images or raw into the stdin of --pipe.
+   */
+  bool headless_mode = false;
+  int frames = 1;
+  std::string output = "../frame";
+  std::string format = "tga";
+  std::string cameras_file;
+  std::string camera_path;
+  std::string pipe_cmd;
+  float rate = 30.0f;
+  std::vector<std::string> args;
+  int i;
+  for (i=1; i<argc; i++) {
+    if (strcmp(argv[i], "--headless") == 0) {
+      headless_mode = true;
+    } else if (strncmp(argv[i], "--frames=", 9) == 0) {
+      frames = atoi(argv[i] + 9);
+    } else if (strncmp(argv[i], "--output=", 9) == 0) {
+      output = argv[i] + 9;
+    } else if (strncmp(argv[i], "--format=", 9) == 0) {
+      format = argv[i] + 9;
+    } else if (strncmp(argv[i], "--cameras=", 10) == 0) {
+      cameras_file = argv[i] + 10;
+      headless_mode = true;
+    } else if (strncmp(argv[i], "--camera-path=", 14) == 0) {
+      camera_path = argv[i] + 14;
+      headless_mode = true;
+    } else if (strncmp(argv[i], "--rate=", 7) == 0) {
+      rate = atof(argv[i] + 7);
+    } else if (strncmp(argv[i], "--pipe=", 7) == 0) {
+      pipe_cmd = argv[i] + 7;
+    } else {
+      args.push_back(argv[i]);
+    }
+  }
+
+  if (args.size() != 1 && args.size() != 2) {
     std::cout << "Please specify input file" << std::endl;
+    std::cout << "Usage: render [--headless [--frames=N]] "
+                 "[--cameras=FILE] [--output=PREFIX] "
+                 "[--format=tga|png|raw] "
+                 "[--camera-path=FILE [--rate=FPS] [--pipe=CMD]] "
+                 "<scene.json> [trace.json]" << std::endl;
     exit(0);
   }
+  if (format != "tga" && format != "png" && format != "raw") {
+    printf("Unknown --format=%s, expected tga, png or raw\n",
+      format.c_str());
+    exit(1);
+  }
 
-  glfwInit();
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 2);
-  glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-  glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-  glfwWindowHint(GLFW_RESIZABLE, GL_FALSE);
-
-  GLFWwindow *window = glfwCreateWindow(WIDTH_PIXELS, HEIGHT_PIXELS,
-    "OpenGL", NULL, NULL) ;
-  glfwMakeContextCurrent(window);
+  /* Startup and the first TRACE_FRAMES frames, as Chrome trace JSON */
+  std::string trace_file = args.size() == 2 ? args[1] : "";
+  if (!trace_file.empty()) {
+    trace::start();
+  }
 
-  if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
-    printf("FAILED TO LOAD GLAD!\n"); 
-    return EXIT_FAILURE;
+  GLFWwindow *window = NULL;
+  if (headless_mode) {
+    if (!headless::init()) {
+      printf("FAILED TO CREATE HEADLESS CONTEXT!\n");
+      return EXIT_FAILURE;
+    }
+  } else {
+    glfwInit();
+    /* 4.3 for compute shaders and shader storage buffers */
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+    glfwWindowHint(GLFW_RESIZABLE, GL_FALSE);
+
+    window = glfwCreateWindow(WIDTH_PIXELS, HEIGHT_PIXELS,
+      "OpenGL", NULL, NULL) ;
+    glfwMakeContextCurrent(window);
+
+    if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
+      printf("FAILED TO LOAD GLAD!\n"); 
+      return EXIT_FAILURE;
+    }
   }
 
   //////////////////////////////////////////////////////////////////////
-  scene = {argv[1], WIDTH_PIXELS, HEIGHT_PIXELS};
+  scene = {args[0], WIDTH_PIXELS, HEIGHT_PIXELS};
   //////////////////////////////////////////////////////////////////////
 
-  auto ld_shaders = [](const char *nvs, const char *nfs)
-    -> GLuint {
-    // Load shadow map shaders
-    GLuint prog_id;
-    std::vector<ShaderProg> progs;
-    ShaderProg vs, fs;
-    vs = {nvs, GL_VERTEX_SHADER};
-    fs = {nfs, GL_FRAGMENT_SHADER};
-    progs.push_back(vs);
-    progs.push_back(fs);
-    bind_shaders(progs, prog_id);
-    return prog_id;
-  };
+  /* Deleted before the context goes away */
+  Renderer *renderer = new Renderer(scene, WIDTH_PIXELS, HEIGHT_PIXELS,
+                                    headless_mode);
+  PassTimer &timer = renderer->timer;
+  FILE *profile_csv = NULL;
 
-  /*
-   * Note: we do not need the M_vp (i.e. viewport transformation)
-   * because OpenGL does this automatically for us in the
-   * vertex processing stage (right after the vertex shader).
-   * It applies the viewport transformation since it knows 
-   * the screen width, height, and depth of our vertices.
-   *
-   * Note: the perspective (i.e. projection) matrix does not
-   * change in between frames, so we can create it once, and
-   * reuse it.
-  */
-  GLuint prog_id = ld_shaders("../glsl/model-view-proj.vs", 
-                              "../glsl/per-frag-blinn-phong.fs");
-
-  glfwSetScrollCallback(
-    window,
-    [](GLFWwindow *window, double xoffset, double yoffset) {
-      window_callback_scroll(xoffset, yoffset);
+  /* Images are only written once every texture is in */
+  if (headless_mode) {
+    scene.streamer->flush();
+  }
+  if (scene.profile && !scene.profile_csv.empty()) {
+    profile_csv = fopen(scene.profile_csv.c_str(), "w");
+    if (profile_csv == NULL) {
+      printf("Failed to open file: %s\n", scene.profile_csv.c_str());
     }
-  );
+  }
 
-  glfwSetMouseButtonCallback(
-    window,
-    [](GLFWwindow *window, int btn, int action, int mods) {
-      window_callback_mouse_btn(btn, action, mods);
+  /* File name of image i, any '%' of the prefix taken literally */
+  std::string pattern;
+  for (char c : output) {
+    pattern += c == '%' ? "%%" : std::string(1, c);
+  }
+  pattern += "_%04d." + format;
+  if (!camera_path.empty()) {
+    std::vector<capture::Key> keys;
+    if (rate <= 0.0f) {
+      printf("--rate must be positive\n");
+    } else if (capture::load_path(camera_path, *scene.orient, keys)) {
+      capture::record(scene, *renderer, keys, rate, pattern, pipe_cmd);
     }
-  );
-
-  glfwSetCursorPosCallback(window,
-    [](GLFWwindow *window, double xpos, double ypos) {
-      window_callback_cursor_pos((float)xpos, (float)ypos);
+  } else if (!cameras_file.empty()) {
+    std::vector<Orientation> cameras;
+    if (batch::load_cameras(cameras_file, *scene.orient, cameras)) {
+      batch::render(scene, *renderer, cameras, pattern);
     }
-  );
-  
-  glEnable(GL_DEPTH_TEST);
-  glEnable(GL_CULL_FACE);
-  glCullFace(GL_BACK);
-  time_p tic, toc;
-  duration<int, std::milli> fps(MAX_MS_PER_FRAME);
-  while (!glfwWindowShouldClose(window)) {
-    tic = clock::now();
-    glClearColor(46.0f/255.0f, 56.0f/255.0f, 71.0f/255.0f, 1.0f);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-    // Bind the shaders
-    glUseProgram(prog_id);
-
-    GLint M_proj_id, M_per_id, M_cam_id;
-    GLint ks_id, kd_id, ka_id, Ia_id, p_id;
-    GLint num_lights_id;
-    M_per_id = glGetUniformLocation(prog_id, "per");
-    M_cam_id = glGetUniformLocation(prog_id, "view");
-    ks_id = glGetUniformLocation(prog_id, "ks");
-    kd_id = glGetUniformLocation(prog_id, "kd");
-    ka_id = glGetUniformLocation(prog_id, "ka");
-    Ia_id = glGetUniformLocation(prog_id, "Ia");
-    p_id = glGetUniformLocation(prog_id, "p");
-    num_lights_id = glGetUniformLocation(prog_id, "num_lights");
-
-    // Send uniform variables to device
-    Orientation *orient = scene.orient;
-    glUniformMatrix4fv(M_per_id, 1, 
-                       GL_FALSE, 
-                       orient->perspective(WIDTH_PIXELS, HEIGHT_PIXELS));
-    glUniformMatrix4fv(M_cam_id, 1, 
-                       GL_FALSE, 
-                       orient->view());
-    glUniform3fv(ks_id, 1, scene.Ks());
-    glUniform3fv(kd_id, 1, scene.Kd());
-    glUniform3fv(ka_id, 1, scene.Ka());
-    glUniform3fv(Ia_id, 1, scene.Ia());
-    glUniform1i(num_lights_id, scene.lights_.size());
-    glUniform1f(p_id, scene.p);
-    scene.ld_lights_uniform(prog_id, 
-                           "lights[%d].position",
-                           "lights[%d].intensity",
-                           "lights[%d].shadowMat",
-                           1);
-
-    GLint shadow_id;
-    shadow_id = glGetUniformLocation(prog_id, "shadowMaps");
-    glUniform1i(shadow_id, 0);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D_ARRAY, scene.shadowMap->tex);
-
-    GLint tex_id, M_model_id;
-    tex_id = glGetUniformLocation(prog_id, "tex");
-    M_model_id = glGetUniformLocation(prog_id, "model");
-    glUniform1i(tex_id, 1);
-
-    for (Model *&model : scene.models) {
-      // Bind texture for model
-      if (model->tex_ != NULL) {
-        glUniformMatrix4fv(M_model_id, 1, false, model->model());
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, model->tex_->id);
+  } else if (headless_mode) {
+    Readback readback;
+    char path[1024];
+    for (i=0; i<frames; i++) {
+      TRACE_ZONE("frame");
+      timer.frame();
+      renderer->update(scene);
+      renderer->render(scene);
+
+      snprintf(path, sizeof(path), pattern.c_str(), i);
+      screen::color_2D_screenshot(readback,
+                                  renderer->target->fbo,
+                                  GL_COLOR_ATTACHMENT0,
+                                  WIDTH_PIXELS, HEIGHT_PIXELS,
+                                  path);
+      readback.poll();
+    }
+    readback.flush();
+    screen::finish();
+    printf("Wrote %d frame(s) to %s_*.%s\n", 
+      frames, output.c_str(), format.c_str());
+
+    if (scene.profile) {
+      timer.print(stdout);
+      if (profile_csv != NULL) {
+        timer.write_csv(profile_csv);
+      }
+    }
+  } else {
+    /* Uncapped measures throughput, so never block on the display */
+    glfwSwapInterval(scene.vsync && !scene.uncapped ? 1 : 0);
+
+    glfwSetScrollCallback(
+      window,
+      [](GLFWwindow *window, double xoffset, double yoffset) {
+        window_callback_scroll(xoffset, yoffset);
       }
+    );
 
-      glBindVertexArray(model->data_->vao);
-      glDrawArrays(GL_TRIANGLES, 0, model->data_->size());
-    } 
-
-    // Unbind the shaders
-    glBindTexture(GL_TEXTURE_2D, 0);
-    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
-    glBindVertexArray(0);
-    glUseProgram(0);
-
-    glfwSwapBuffers(window);
-    glfwPollEvents();
-
-    // FPS controller
-    toc = clock::now();
-    using millis = std::chrono::milliseconds;
-    auto elapsed_ms = duration_cast<millis>(toc-tic);
-    if (elapsed_ms < fps) {
-      auto left = fps-elapsed_ms;
-      std::this_thread::sleep_for(left);
-    } 
+    glfwSetMouseButtonCallback(
+      window,
+      [](GLFWwindow *window, int btn, int action, int mods) {
+        window_callback_mouse_btn(btn, action, mods);
+      }
+    );
+
+    glfwSetCursorPosCallback(window,
+      [](GLFWwindow *window, double xpos, double ypos) {
+        window_callback_cursor_pos((float)xpos, (float)ypos);
+      }
+    );
+
+    /* Exposed or damaged: the window needs the frame again */
+    glfwSetWindowRefreshCallback(window,
+      [](GLFWwindow *window) {
+        FRAME_DIRTY = true;
+      }
+    );
+
+    FramePacer pacer(scene.uncapped ? 0.0f : 
+                     scene.fps > 0.0f ? scene.fps : FPS);
+    int traced_frames = 0;
+    while (!glfwWindowShouldClose(window)) {
+      if (renderer->update(scene)) {
+        FRAME_DIRTY = true;
+      }
+
+      /*
+       * On demand: nothing changed, so the frame on screen is still
+       * current. Block until an event arrives instead of redrawing;
+       * other threads changing the scene wake us with
+       * glfwPostEmptyEvent().
+       */
+      if (scene.on_demand && !FRAME_DIRTY) {
+        /* Textures still streaming in: look again shortly */
+        if (scene.streamer->pending() > 0) {
+          glfwWaitEventsTimeout(STREAM_POLL_S);
+        } else {
+          glfwWaitEvents();
+        }
+        continue;
+      }
+      FRAME_DIRTY = false;
+
+      TRACE_ZONE("frame");
+      pacer.begin();
+      timer.frame();
+
+      renderer->render(scene);
+
+      timer.begin("swap");
+      {
+        TRACE_ZONE("swap");
+        glfwSwapBuffers(window);
+      }
+      timer.end();
+      pacer.end();
+      glfwPollEvents();
+
+      if (scene.profile && timer.frame_count() % PROFILE_FRAMES == 0) {
+        timer.print(stdout);
+        if (profile_csv != NULL) {
+          timer.write_csv(profile_csv);
+        }
+        timer.reset();
+      }
+
+      if (scene.uncapped && pacer.frames() >= FRAME_STATS_FRAMES) {
+        FramePacer::Stats st = pacer.stats();
+        printf("Frame times over %d frames: min %.3f ms, avg %.3f ms, "
+               "p99 %.3f ms (%.1f fps)\n",
+          (int)st.frames, st.min_ms, st.avg_ms, st.p99_ms, 
+          1000.0 / st.avg_ms);
+        pacer.reset();
+      }
+
+      // FPS controller
+      {
+        TRACE_ZONE("wait");
+        pacer.wait();
+      }
+
+      if (trace::active() && ++traced_frames == TRACE_FRAMES) {
+        trace::stop();
+        if (trace::write(trace_file)) {
+          printf("Trace written: %s\n", trace_file.c_str());
+        }
+      }
+    }
   }
 
-  glfwTerminate();
+  /* Closed before TRACE_FRAMES */
+  if (trace::active()) {
+    trace::stop();
+    trace::write(trace_file);
+  }
+  if (profile_csv != NULL) {
+    fclose(profile_csv);
+  }
+  delete renderer;
+  if (headless_mode) {
+    headless::terminate();
+  } else {
+    glfwTerminate();
+  }
 }
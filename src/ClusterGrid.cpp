@@ -0,0 +1,190 @@
+#include <cmath>
+#include <algorithm>
+#include <limits>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "types.hpp"
+
+#define NUM_CLUSTERS (ClusterGrid::X * ClusterGrid::Y * ClusterGrid::Z)
+
+static inline int cluster_id(int x, int y, int z) {
+  return (z * ClusterGrid::Y + y) * ClusterGrid::X + x;
+}
+
+/* View space depth (distance along -z) at which slice k begins */
+static inline float slice_depth(int k, float n, float f) {
+  return n * powf(f / n, (float)k / ClusterGrid::Z);
+}
+
+ClusterGrid::ClusterGrid(int w, int h)
+  : width(w)
+  , height(h)
+  , fovy(0)
+  , aspect(0)
+  , zNear(0)
+  , zFar(0)
+{
+  lo.resize(NUM_CLUSTERS);
+  hi.resize(NUM_CLUSTERS);
+  clusters.resize(2*NUM_CLUSTERS);
+  bins.resize(NUM_CLUSTERS);
+
+  glGenBuffers(1, &light_buf);
+  glGenBuffers(1, &cluster_buf);
+  glGenBuffers(1, &index_buf);
+}
+
+ClusterGrid::~ClusterGrid() {
+  glDeleteBuffers(1, &light_buf);
+  glDeleteBuffers(1, &cluster_buf);
+  glDeleteBuffers(1, &index_buf);
+}
+
+/*
+ * Each cluster is the part of a screen tile's frustum between two
+ * depth slices. Its AABB is spanned by the tile's 4 corner rays at
+ * the slice's near and far depth.
+ */
+void ClusterGrid::build_clusters(float fy, float a, float n, float f) {
+  fovy = fy;
+  aspect = a;
+  zNear = n;
+  zFar = f;
+
+  float ty = tanf(glm::radians(fovy) / 2.0f);
+  float tx = ty * aspect;
+
+  int x, y, z;
+  for (z=0; z<Z; z++) {
+    float d0 = slice_depth(z, n, f);
+    float d1 = slice_depth(z+1, n, f);
+    for (y=0; y<Y; y++) {
+      float y0 = -1.0f + 2.0f * y / Y;
+      float y1 = -1.0f + 2.0f * (y+1) / Y;
+      for (x=0; x<X; x++) {
+        float x0 = -1.0f + 2.0f * x / X;
+        float x1 = -1.0f + 2.0f * (x+1) / X;
+
+        glm::vec3 l(std::numeric_limits<float>::max());
+        glm::vec3 h(-std::numeric_limits<float>::max());
+        float ds[2] = {d0, d1};
+        float xs[2] = {x0, x1};
+        float ys[2] = {y0, y1};
+        int i, j, k;
+        for (i=0; i<2; i++)
+          for (j=0; j<2; j++)
+            for (k=0; k<2; k++) {
+              glm::vec3 p(xs[j] * tx * ds[i], ys[k] * ty * ds[i], -ds[i]);
+              l = glm::min(l, p);
+              h = glm::max(h, p);
+            }
+
+        int id = cluster_id(x, y, z);
+        lo[id] = l;
+        hi[id] = h;
+      }
+    }
+  }
+}
+
+void ClusterGrid::update(Scene &scene) {
+  Orientation *orient = scene.orient;
+  float a = (float)width / (float)height;
+  if (orient->fovy != fovy || a != aspect ||
+      orient->zNear != zNear || orient->zFar != zFar) {
+    build_clusters(orient->fovy, a, orient->zNear, orient->zFar);
+  }
+
+  int c;
+  for (c=0; c<NUM_CLUSTERS; c++) {
+    bins[c].clear();
+  }
+
+  const glm::mat4 &view = orient->view_;
+  lights.resize(scene.lights_.size());
+
+  size_t i;
+  for (i=0; i<scene.lights_.size(); i++) {
+    Light &light = scene.lights_[i];
+    GPULight &g = lights[i];
+    g.position = glm::vec4(light.position, light.radius);
+    g.intensity = glm::vec4(light.intensity, 0.0f);
+    g.shadowMat = light.Mvp_bias();
+
+    if (light.radius <= 0.0f) {
+      for (c=0; c<NUM_CLUSTERS; c++) {
+        bins[c].push_back(i);
+      }
+      continue;
+    }
+
+    /* Only the slices overlapping the sphere's depth range */
+    glm::vec4 _p = view * glm::vec4(light.position, 1.0f);
+    glm::vec3 p(_p.x, _p.y, _p.z);
+    float r = light.radius;
+    float dmin = -p.z - r, dmax = -p.z + r;
+    if (dmax < zNear || dmin > zFar) {
+      continue;
+    }
+
+    float lf = logf(zFar / zNear);
+    int z0 = dmin <= zNear ? 0 : (int)(logf(dmin / zNear) / lf * Z);
+    int z1 = dmax >= zFar ? Z-1 : (int)(logf(dmax / zNear) / lf * Z);
+    z0 = std::max(0, std::min(z0, Z-1));
+    z1 = std::max(0, std::min(z1, Z-1));
+
+    int x, y, z;
+    for (z=z0; z<=z1; z++)
+      for (y=0; y<Y; y++)
+        for (x=0; x<X; x++) {
+          int id = cluster_id(x, y, z);
+          glm::vec3 q = glm::max(lo[id], glm::min(p, hi[id]));
+          glm::vec3 d = q - p;
+          if (glm::dot(d, d) <= r*r) {
+            bins[id].push_back(i);
+          }
+        }
+  }
+
+  /* Flatten the bins into (offset, count) + one index list */
+  indices.clear();
+  for (c=0; c<NUM_CLUSTERS; c++) {
+    clusters[2*c] = (GLuint)indices.size();
+    clusters[2*c+1] = (GLuint)bins[c].size();
+    indices.insert(indices.end(), bins[c].begin(), bins[c].end());
+  }
+  if (indices.empty()) {
+    indices.push_back(0);
+  }
+
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, light_buf);
+  glBufferData(GL_SHADER_STORAGE_BUFFER,
+               std::max(lights.size(), (size_t)1)*sizeof(GPULight),
+               lights.empty() ? NULL : lights.data(),
+               GL_STREAM_DRAW);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, cluster_buf);
+  glBufferData(GL_SHADER_STORAGE_BUFFER,
+               clusters.size()*sizeof(GLuint),
+               clusters.data(),
+               GL_STREAM_DRAW);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, index_buf);
+  glBufferData(GL_SHADER_STORAGE_BUFFER,
+               indices.size()*sizeof(GLuint),
+               indices.data(),
+               GL_STREAM_DRAW);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void ClusterGrid::bind(GLuint prog) {
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, light_buf);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, cluster_buf);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, index_buf);
+
+  glUniform3ui(glGetUniformLocation(prog, "grid"), X, Y, Z);
+  glUniform2f(glGetUniformLocation(prog, "tile_size"),
+              (float)width / X, (float)height / Y);
+  glUniform1f(glGetUniformLocation(prog, "zNear"), zNear);
+  glUniform1f(glGetUniformLocation(prog, "zFar"), zFar);
+}
@@ -1,8 +1,10 @@
 #include "types.hpp"
 #include "lib.hpp"
 #include "helpers.h"
+#include "trace.hpp"
 
 Data::Data(const char *f) : filename(f) {
+  TRACE_ZONE_DETAIL("Data", filename);
   /*
    we can define this locally in this function because GL
    will copy all of this to GPU anyways, we do not need
@@ -12,6 +14,18 @@ Data::Data(const char *f) : filename(f) {
    (i.e. no need for vertex processing)
   */
   load_obj(filename, data);
+
+  bbox_min = glm::vec3(std::numeric_limits<float>::max());
+  bbox_max = glm::vec3(-std::numeric_limits<float>::max());
+  for (const ld_o::VBO_STRUCT &s : data) {
+    bbox_min = glm::min(bbox_min, s.v);
+    bbox_max = glm::max(bbox_max, s.v);
+  }
+  if (data.empty()) {
+    bbox_min = bbox_max = glm::vec3(0.0f);
+  }
+
+  TRACE_ZONE("upload vbo");
   vbo = init_static_array_vbo((void *)data.data(), 
                               data.size()*sizeof(ld_o::VBO_STRUCT));
   vao = init_array_VBO_STRUCT_vao(vbo,
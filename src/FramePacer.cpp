@@ -0,0 +1,85 @@
+#include <cmath>
+#include <algorithm>
+#include <thread>
+
+#include "types.hpp"
+
+/*
+ * Wake this long before the deadline and spin the rest. Covers
+ * the sleep overshoot of a typical scheduler tick.
+ */
+#define SPIN_US 2000
+
+
+FramePacer::FramePacer(float fps)
+  : period(fps > 0.0f ? 
+      std::chrono::duration_cast<clock::duration>(
+        std::chrono::duration<double>(1.0 / fps)) : 
+      clock::duration::zero())
+  , deadline(clock::now())
+  , start(clock::now())
+  , next(0)
+{
+}
+
+void FramePacer::begin() {
+  start = clock::now();
+}
+
+void FramePacer::end() {
+  std::chrono::duration<double, std::milli> ms = clock::now() - start;
+  if (times.size() < HISTORY) {
+    times.push_back(ms.count());
+  } else {
+    times[next] = ms.count();
+    next = (next + 1) % HISTORY;
+  }
+}
+
+void FramePacer::wait() {
+  if (period == clock::duration::zero()) {
+    return;
+  }
+
+  /*
+   * Deadlines advance by exactly one period so rounding never
+   * accumulates. After a stall of more than a frame, start over
+   * from now instead of rushing to catch up.
+   */
+  clock::time_point now = clock::now();
+  deadline += period;
+  if (deadline + period < now) {
+    deadline = now;
+    return;
+  }
+
+  const clock::duration spin = std::chrono::microseconds(SPIN_US);
+  if (deadline - now > spin) {
+    std::this_thread::sleep_until(deadline - spin);
+  }
+  while (clock::now() < deadline) {
+    std::this_thread::yield();
+  }
+}
+
+FramePacer::Stats FramePacer::stats() const {
+  Stats s = {0, 0.0, 0.0, 0.0};
+  if (times.empty()) {
+    return s;
+  }
+
+  std::vector<double> sorted(times);
+  std::sort(sorted.begin(), sorted.end());
+
+  double sum = 0.0;
+  size_t i;
+  for (i=0; i<sorted.size(); i++) {
+    sum += sorted[i];
+  }
+
+  s.frames = sorted.size();
+  s.min_ms = sorted.front();
+  s.avg_ms = sum / sorted.size();
+  s.p99_ms = sorted[(size_t)ceil(0.99 * sorted.size()) - 1];
+  return s;
+}
@@ -0,0 +1,152 @@
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "types.hpp"
+#include "lib.hpp"
+
+#define GBUFFER_VS "../glsl/gbuffer.vs"
+#define GBUFFER_FS "../glsl/gbuffer.fs"
+#define DEFERRED_LIGHTING_VS "../glsl/deferred-lighting.vs"
+#define DEFERRED_LIGHTING_FS "../glsl/deferred-lighting.fs"
+
+GLenum GBuffer::DRAW_BUFFERS[2] = {
+  GL_COLOR_ATTACHMENT0,
+  GL_COLOR_ATTACHMENT1
+};
+
+static GLuint alloc_tex(GLenum format, int width, int height) {
+  GLuint tex;
+  glGenTextures(1, &tex);
+  glBindTexture(GL_TEXTURE_2D, tex);
+  glTexStorage2D(GL_TEXTURE_2D, 1, format, width, height);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  return tex;
+}
+
+GBuffer::GBuffer(int w, int h)
+  : width(w)
+  , height(h)
+{
+  albedo = alloc_tex(GL_RGBA8, width, height);
+  normal = alloc_tex(GL_RG16F, width, height);
+  /* Float depth, so it can also feed the Hi-Z pyramid */
+  depth = alloc_tex(GL_DEPTH_COMPONENT32F, width, height);
+
+  glGenFramebuffers(1, &fbo);
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+  glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, albedo, 0);
+  glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, normal, 0);
+  glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depth, 0);
+  glDrawBuffers(2, DRAW_BUFFERS);
+  check_fbo_status(fbo, GL_FRAMEBUFFER);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+  glGenVertexArrays(1, &vao);
+
+  geometry_prog = load_shaders_simple(GBUFFER_VS, GBUFFER_FS);
+  lighting_prog = load_shaders_simple(DEFERRED_LIGHTING_VS, 
+                                      DEFERRED_LIGHTING_FS);
+}
+
+void GBuffer::prefetch_programs() {
+  prefetch_shaders_simple(GBUFFER_VS, GBUFFER_FS);
+  prefetch_shaders_simple(DEFERRED_LIGHTING_VS, DEFERRED_LIGHTING_FS);
+}
+
+GBuffer::~GBuffer() {
+  glDeleteFramebuffers(1, &fbo);
+  glDeleteTextures(1, &albedo);
+  glDeleteTextures(1, &normal);
+  glDeleteTextures(1, &depth);
+  glDeleteVertexArrays(1, &vao);
+  glDeleteProgram(geometry_prog);
+  glDeleteProgram(lighting_prog);
+}
+
+void GBuffer::begin(Scene &scene, const glm::mat4 &viewProj) {
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+  glViewport(0, 0, width, height);
+  glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+  glUseProgram(geometry_prog);
+  glUniformMatrix4fv(glGetUniformLocation(geometry_prog, "viewProj"), 1,
+                     GL_FALSE, glm::value_ptr(viewProj));
+  glUniform3fv(glGetUniformLocation(geometry_prog, "kd"), 1, scene.Kd());
+  glUniform1i(glGetUniformLocation(geometry_prog, "tex"), 1);
+}
+
+void GBuffer::bind_model(Model *model) {
+  glUniformMatrix4fv(glGetUniformLocation(geometry_prog, "model"), 1,
+                     GL_FALSE, model->model());
+  glUniform1i(glGetUniformLocation(geometry_prog, "textured"),
+              model->tex_ != NULL);
+  if (model->tex_ != NULL) {
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, model->tex_->id);
+  }
+
+  glBindVertexArray(model->data_->vao);
+}
+
+void GBuffer::shade(Scene &scene,
+                    ClusterGrid &clusters,
+                    const glm::mat4 &viewProj,
+                    GLuint FBO) {
+  Orientation *orient = scene.orient;
+  GLuint prog = lighting_prog;
+
+  glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+  glViewport(0, 0, width, height);
+
+  /* One fragment per pixel, no depth test against anything */
+  glDisable(GL_DEPTH_TEST);
+  glDepthMask(GL_FALSE);
+
+  glUseProgram(prog);
+  clusters.update(scene);
+  clusters.bind(prog);
+
+  glm::mat4 inv = glm::inverse(viewProj);
+  glUniformMatrix4fv(glGetUniformLocation(prog, "invViewProj"), 1,
+                     GL_FALSE, glm::value_ptr(inv));
+  glUniformMatrix4fv(glGetUniformLocation(prog, "view"), 1,
+                     GL_FALSE, glm::value_ptr(orient->view_));
+  glUniform3fv(glGetUniformLocation(prog, "eye"), 1, 
+               glm::value_ptr(orient->eye));
+  glUniform3fv(glGetUniformLocation(prog, "ks"), 1, scene.Ks());
+  glUniform3fv(glGetUniformLocation(prog, "ka"), 1, scene.Ka());
+  glUniform3fv(glGetUniformLocation(prog, "Ia"), 1, scene.Ia());
+  glUniform1f(glGetUniformLocation(prog, "p"), scene.p);
+
+  glUniform1i(glGetUniformLocation(prog, "shadows"), 0);
+  glUniform1i(glGetUniformLocation(prog, "albedo"), 1);
+  glUniform1i(glGetUniformLocation(prog, "normal"), 2);
+  glUniform1i(glGetUniformLocation(prog, "depth"), 3);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, scene.shadowMap->tex);
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_2D, albedo);
+  glActiveTexture(GL_TEXTURE2);
+  glBindTexture(GL_TEXTURE_2D, normal);
+  glActiveTexture(GL_TEXTURE3);
+  glBindTexture(GL_TEXTURE_2D, depth);
+
+  glBindVertexArray(vao);
+  glDrawArrays(GL_TRIANGLES, 0, 3);
+
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glActiveTexture(GL_TEXTURE2);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glActiveTexture(GL_TEXTURE0);
+
+  glDepthMask(GL_TRUE);
+  glEnable(GL_DEPTH_TEST);
+}
@@ -0,0 +1,281 @@
+#include <stdio.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "types.hpp"
+#include "trace.hpp"
+
+#define PNG_LEVEL 3    /* zlib level: most of the size win, little time */
+#define TGA_MAX_RUN 128
+
+typedef std::vector<unsigned char> Bytes;
+
+static void put_u32_be(Bytes &out, uint32_t v) {
+  out.push_back((unsigned char)(v >> 24));
+  out.push_back((unsigned char)(v >> 16));
+  out.push_back((unsigned char)(v >> 8));
+  out.push_back((unsigned char)v);
+}
+
+/*
+ * Run length encoded TGA (image type 10 / 11). Packets never cross
+ * a row, as the spec recommends. A run packet repeats one pixel up
+ * to 128 times; a raw packet holds up to 128 literal pixels.
+ */
+static void encode_tga_rle(const unsigned char *data,
+                           int width,
+                           int height,
+                           int bpp,
+                           Bytes &out) {
+  unsigned char header[18];
+  memset(header, 0, sizeof(header));
+  header[2] = bpp == 1 ? 11 : 10;
+  header[12] = (unsigned char)(width & 0xFF);
+  header[13] = (unsigned char)(width >> 8);
+  header[14] = (unsigned char)(height & 0xFF);
+  header[15] = (unsigned char)(height >> 8);
+  header[16] = (unsigned char)(8 * bpp);
+  out.insert(out.end(), header, header + sizeof(header));
+
+  auto same = [bpp](const unsigned char *a, const unsigned char *b) {
+    return memcmp(a, b, bpp) == 0;
+  };
+
+  int y;
+  for (y=0; y<height; y++) {
+    const unsigned char *row = data + (size_t)y * width * bpp;
+    int x = 0;
+    while (x < width) {
+      const unsigned char *p = row + x * bpp;
+      int n = 1;
+      while (x + n < width && n < TGA_MAX_RUN && same(p, p + n * bpp)) {
+        n++;
+      }
+
+      if (n > 1) {
+        out.push_back((unsigned char)(0x80 | (n - 1)));
+        out.insert(out.end(), p, p + bpp);
+      } else {
+        /* Literals up to where the next run starts */
+        while (x + n < width && n < TGA_MAX_RUN &&
+               !(x + n + 1 < width &&
+                 same(p + n * bpp, p + (n + 1) * bpp))) {
+          n++;
+        }
+        out.push_back((unsigned char)(n - 1));
+        out.insert(out.end(), p, p + n * bpp);
+      }
+      x += n;
+    }
+  }
+}
+
+static void png_chunk(Bytes &out, const char *type,
+                      const unsigned char *data, size_t size) {
+  put_u32_be(out, (uint32_t)size);
+  size_t start = out.size();
+  out.insert(out.end(), type, type + 4);
+  out.insert(out.end(), data, data + size);
+  put_u32_be(out, (uint32_t)crc32(0, &out[start], (uInt)(size + 4)));
+}
+
+/*
+ * 8 bit greyscale or RGB PNG. GL rows are bottom up and BGR, so
+ * rows are flipped and swizzled on the way into the filter, which
+ * is "Sub" (difference to the pixel on the left) for every row.
+ */
+static bool encode_png(const unsigned char *data,
+                       int width,
+                       int height,
+                       int bpp,
+                       Bytes &out) {
+  static const unsigned char signature[8] = {
+    0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'
+  };
+  out.insert(out.end(), signature, signature + 8);
+
+  Bytes ihdr;
+  put_u32_be(ihdr, (uint32_t)width);
+  put_u32_be(ihdr, (uint32_t)height);
+  ihdr.push_back(8);              /* Bit depth */
+  ihdr.push_back(bpp == 1 ? 0 : 2); /* Grey or RGB */
+  ihdr.push_back(0);              /* Deflate */
+  ihdr.push_back(0);              /* Adaptive filtering */
+  ihdr.push_back(0);              /* No interlace */
+  png_chunk(out, "IHDR", ihdr.data(), ihdr.size());
+
+  size_t stride = (size_t)width * bpp;
+  Bytes filtered((stride + 1) * height);
+  Bytes line(stride);
+  int x, y, c;
+  for (y=0; y<height; y++) {
+    const unsigned char *src = data + (height - 1 - y) * stride;
+    if (bpp == 3) {
+      for (x=0; x<width; x++) {
+        line[3*x] = src[3*x+2];
+        line[3*x+1] = src[3*x+1];
+        line[3*x+2] = src[3*x];
+      }
+    } else {
+      memcpy(line.data(), src, stride);
+    }
+
+    unsigned char *dst = &filtered[y * (stride + 1)];
+    dst[0] = 1; /* Sub */
+    for (c=0; c<bpp; c++) {
+      dst[1+c] = line[c];
+    }
+    for (x=bpp; x<(int)stride; x++) {
+      dst[1+x] = (unsigned char)(line[x] - line[x-bpp]);
+    }
+  }
+
+  uLongf size = compressBound((uLong)filtered.size());
+  Bytes idat(size);
+  if (compress2(idat.data(), &size,
+                filtered.data(), (uLong)filtered.size(),
+                PNG_LEVEL) != Z_OK) {
+    return false;
+  }
+  png_chunk(out, "IDAT", idat.data(), size);
+  png_chunk(out, "IEND", NULL, 0);
+  return true;
+}
+
+ImageWriter::ImageWriter(int threads, int buffers)
+  : stalls(0)
+  , max_buffers(buffers)
+  , writing(0)
+  , stop(false)
+{
+  int i;
+  for (i=0; i<threads; i++) {
+    workers.push_back(std::thread(&ImageWriter::run, this));
+  }
+}
+
+ImageWriter::~ImageWriter() {
+  {
+    std::unique_lock<std::mutex> l(lock);
+    stop = true;
+  }
+  queued.notify_all();
+  for (std::thread &t : workers) {
+    t.join();
+  }
+  for (Buffer *buf : pool) {
+    delete buf;
+  }
+}
+
+ImageWriter::Buffer *ImageWriter::acquire(size_t size) {
+  Buffer *buf;
+  {
+    std::unique_lock<std::mutex> l(lock);
+    if (idle.empty() && pool.size() < max_buffers) {
+      buf = new Buffer();
+      pool.push_back(buf);
+    } else {
+      if (idle.empty()) {
+        TRACE_ZONE("writer stall");
+        stalls++;
+        released.wait(l, [this] { return !idle.empty(); });
+      }
+      buf = idle.back();
+      idle.pop_back();
+    }
+  }
+
+  /* Keeps its capacity, so a steady capture stops allocating */
+  buf->resize(size);
+  return buf;
+}
+
+void ImageWriter::submit(Buffer *buf,
+                         int width,
+                         int height,
+                         screen::ImageType type,
+                         screen::ImageFormat format,
+                         const std::string &path) {
+  {
+    std::unique_lock<std::mutex> l(lock);
+    jobs.push_back({buf, width, height, type, format, path, NULL});
+  }
+  queued.notify_one();
+}
+
+void ImageWriter::submit(Buffer *buf, FILE *stream) {
+  {
+    std::unique_lock<std::mutex> l(lock);
+    jobs.push_back({buf, 0, 0, screen::ImageType::IMAGE_TYPE_RGB,
+                    screen::ImageFormat::IMAGE_FORMAT_RAW, "", stream});
+  }
+  queued.notify_one();
+}
+
+void ImageWriter::wait() {
+  std::unique_lock<std::mutex> l(lock);
+  released.wait(l, [this] { return jobs.empty() && writing == 0; });
+}
+
+void ImageWriter::run() {
+  Bytes out;
+  while (true) {
+    Job job;
+    {
+      std::unique_lock<std::mutex> l(lock);
+      queued.wait(l, [this] { return stop || !jobs.empty(); });
+      if (jobs.empty()) {
+        return; /* Stopped, and everything is written */
+      }
+      job = jobs.front();
+      jobs.pop_front();
+      writing++;
+    }
+
+    if (job.stream != NULL) {
+      TRACE_ZONE("write stream");
+      if (fwrite(job.buf->data(), job.buf->size(), 1, job.stream) != 1) {
+        printf("Failed to write %zu bytes to stream\n", job.buf->size());
+      }
+    } else {
+      TRACE_ZONE_DETAIL("write image", job.path);
+      int bpp = job.type == screen::ImageType::IMAGE_TYPE_RGB ? 3 : 1;
+      const unsigned char *data = job.buf->data();
+      size_t size = job.buf->size();
+
+      bool ok = true;
+      out.clear();
+      switch (job.format) {
+        case screen::ImageFormat::IMAGE_FORMAT_TGA_RLE:
+          encode_tga_rle(data, job.width, job.height, bpp, out);
+          data = out.data();
+          size = out.size();
+          break;
+        case screen::ImageFormat::IMAGE_FORMAT_PNG:
+          ok = encode_png(data, job.width, job.height, bpp, out);
+          data = out.data();
+          size = out.size();
+          break;
+        default:
+        case screen::ImageFormat::IMAGE_FORMAT_RAW:
+          break;
+      }
+
+      FILE *f_out = ok ? fopen(job.path.c_str(), "wb") : NULL;
+      if (f_out == NULL) {
+        printf("Failed to write file: %s\n", job.path.c_str());
+      } else {
+        fwrite(data, size, 1, f_out);
+        fclose(f_out);
+      }
+    }
+
+    {
+      std::unique_lock<std::mutex> l(lock);
+      idle.push_back(job.buf);
+      writing--;
+    }
+    released.notify_all();
+  }
+}
@@ -8,6 +8,7 @@
 Light::Light(std::string p, std::string i, glm::vec3 t, int w, int h) 
   : position(parse_vec3(p))
   , intensity(parse_vec3(i)) 
+  , radius(0.0f)
 {
   glm::vec3 g, e;
   g = glm::vec3(0,0,0) - position;
@@ -2,6 +2,7 @@
 #include <glm/glm.hpp>
 
 #include "mat.hpp"
+#include "cull.hpp"
 #include "types.hpp"
 #include "helpers.h"
 
@@ -13,27 +14,55 @@ Model::Model(Data *d, Texture *t, float r,
 	, rotationDeg_(r)
 	, rotationAxis_(parse_vec3(a))
 	, scale_(parse_vec3(s))
-	, translate_(parse_vec3(tr)) {}
+	, translate_(parse_vec3(tr))
+	, parent_(1.0f)
+	, node_(-1)
+	, dirty_(true)
+	, moved_(true) {}
 
-const GLfloat *Model::model() {
-  glm::mat4 rot, scale, trans;
+void Model::set_parent(const glm::mat4 &world) {
+  parent_ = world;
+  dirty_ = moved_ = true;
+}
 
-  rot = mat::rot(glm::radians(rotationDeg_), rotationAxis_);
+void Model::set_rotation(float deg, const glm::vec3 &axis) {
+  rotationDeg_ = deg;
+  rotationAxis_ = axis;
+  dirty_ = moved_ = true;
+}
 
-  scale = glm::transpose(glm::mat4(
-    scale_[0], 0.0f, 0.0f, 0.0f,
-    0.0f, scale_[1], 0.0f, 0.0f,
-    0.0f, 0.0f, scale_[2], 0.0f,
-    0.0f, 0.0f, 0.0f, 1.0f
-  ));
+void Model::set_scale(const glm::vec3 &s) {
+  scale_ = s;
+  dirty_ = moved_ = true;
+}
 
-  trans = glm::transpose(glm::mat4(
-    1.0f, 0.0f, 0.0f, translate_[0],
-    0.0f, 1.0f, 0.0f, translate_[1],
-    0.0f, 0.0f, 1.0f, translate_[2],
-    0.0f, 0.0f, 0.0f, 1.0f
-  ));
+void Model::set_translate(const glm::vec3 &t) {
+  translate_ = t;
+  dirty_ = moved_ = true;
+}
 
-  model_ = rot * scale * trans;
+const GLfloat *Model::model() {
+  if (!dirty_) {
+    return (const GLfloat *)&model_;
+  }
+
+  mat::mul(parent_, 
+           mat::trs(rotationDeg_, rotationAxis_, scale_, translate_),
+           model_);
+  dirty_ = false;
   return (const GLfloat *)&model_;       
 }
+
+void Model::bounds(glm::vec3 &center, glm::vec3 &extent) {
+  if (moved_) {
+    model();
+    cull::transform_aabb(model_, 
+                         data_->bbox_min, 
+                         data_->bbox_max,
+                         center_, 
+                         extent_);
+    moved_ = false;
+  }
+  center = center_;
+  extent = extent_;
+}
@@ -0,0 +1,165 @@
+#include <stdint.h>
+#include <algorithm>
+#include <glad/glad.h>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "types.hpp"
+#include "lib.hpp"
+
+#define HIZ_INIT_CS "../glsl/hiz-init.cs"
+#define HIZ_DOWNSAMPLE_CS "../glsl/hiz-downsample.cs"
+#define OCCLUSION_CULL_CS "../glsl/occlusion-cull.cs"
+
+#define HIZ_GROUP_SIZE 8
+#define CULL_GROUP_SIZE 64
+
+static inline GLuint groups(int n, int size) {
+  return (GLuint)((n + size - 1) / size);
+}
+
+OcclusionCuller::OcclusionCuller(int w, int h)
+  : width(w)
+  , height(h)
+  , num_models(0)
+{
+  /* Full mip chain down to 1x1 */
+  levels = 1;
+  while ((width >> levels) > 0 || (height >> levels) > 0) {
+    levels++;
+  }
+
+  glGenTextures(1, &hiz);
+  glBindTexture(GL_TEXTURE_2D, hiz);
+  glTexStorage2D(GL_TEXTURE_2D, levels, GL_R32F, width, height);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  glGenBuffers(1, &bounds_buf);
+  glGenBuffers(1, &cmd_buf);
+
+  init_prog = load_shaders_compute(HIZ_INIT_CS);
+  downsample_prog = load_shaders_compute(HIZ_DOWNSAMPLE_CS);
+  cull_prog = load_shaders_compute(OCCLUSION_CULL_CS);
+}
+
+void OcclusionCuller::prefetch_programs() {
+  prefetch_shaders_compute(HIZ_INIT_CS);
+  prefetch_shaders_compute(HIZ_DOWNSAMPLE_CS);
+  prefetch_shaders_compute(OCCLUSION_CULL_CS);
+}
+
+OcclusionCuller::~OcclusionCuller() {
+  glDeleteTextures(1, &hiz);
+  glDeleteBuffers(1, &bounds_buf);
+  glDeleteBuffers(1, &cmd_buf);
+  glDeleteProgram(init_prog);
+  glDeleteProgram(downsample_prog);
+  glDeleteProgram(cull_prog);
+}
+
+/* std430 layout: vec4 center, vec4 extent */
+static std::vector<glm::vec4> pack_bounds(const cull::Bounds &b,
+                                          size_t num_models) {
+  std::vector<glm::vec4> bounds(2*num_models);
+  size_t i;
+  for (i=0; i<num_models; i++) {
+    bounds[2*i] = glm::vec4(b.cx[i], b.cy[i], b.cz[i], 1.0f);
+    bounds[2*i+1] = glm::vec4(b.ex[i], b.ey[i], b.ez[i], 0.0f);
+  }
+  return bounds;
+}
+
+void OcclusionCuller::upload(Scene &scene) {
+  num_models = scene.models.size();
+
+  std::vector<glm::vec4> bounds = pack_bounds(scene.bounds, num_models);
+  std::vector<DrawCmd> cmds(2*num_models);
+  size_t i;
+  for (i=0; i<num_models; i++) {
+    /*
+     * Everything counts as visible in the first frame, so phase 1
+     * lays down a full depth buffer to cull against.
+     */
+    GLuint count = (GLuint)scene.models[i]->data_->size();
+    cmds[i] = {count, 1, 0, 0};
+    cmds[num_models+i] = {count, 0, 0, 0};
+  }
+
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, bounds_buf);
+  glBufferData(GL_SHADER_STORAGE_BUFFER,
+               bounds.size()*sizeof(glm::vec4),
+               bounds.data(),
+               GL_DYNAMIC_DRAW);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, cmd_buf);
+  glBufferData(GL_SHADER_STORAGE_BUFFER,
+               cmds.size()*sizeof(DrawCmd),
+               cmds.data(),
+               GL_DYNAMIC_COPY);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void OcclusionCuller::update_bounds(const Scene &scene) {
+  std::vector<glm::vec4> bounds = pack_bounds(scene.bounds, num_models);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, bounds_buf);
+  glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0,
+                  bounds.size()*sizeof(glm::vec4),
+                  bounds.data());
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void OcclusionCuller::build_hiz(GLuint depth_tex) {
+  glUseProgram(init_prog);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, depth_tex);
+  glBindImageTexture(0, hiz, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+  glDispatchCompute(groups(width, HIZ_GROUP_SIZE),
+                    groups(height, HIZ_GROUP_SIZE),
+                    1);
+
+  glUseProgram(downsample_prog);
+  int level;
+  for (level=1; level<levels; level++) {
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+    int w = std::max(width >> level, 1);
+    int h = std::max(height >> level, 1);
+    glBindImageTexture(0, hiz, level-1, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+    glBindImageTexture(1, hiz, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+    glDispatchCompute(groups(w, HIZ_GROUP_SIZE),
+                      groups(h, HIZ_GROUP_SIZE),
+                      1);
+  }
+
+  glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glUseProgram(0);
+}
+
+void OcclusionCuller::cull(const glm::mat4 &viewProj) {
+  glUseProgram(cull_prog);
+  glUniformMatrix4fv(glGetUniformLocation(cull_prog, "viewProj"), 1,
+                     GL_FALSE, glm::value_ptr(viewProj));
+  glUniform1ui(glGetUniformLocation(cull_prog, "num_models"),
+               (GLuint)num_models);
+  glUniform1i(glGetUniformLocation(cull_prog, "hiz_levels"), levels);
+
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, hiz);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, bounds_buf);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, cmd_buf);
+  glDispatchCompute(groups((int)num_models, CULL_GROUP_SIZE), 1, 1);
+
+  /* Phase 2 sources its draw commands from what was just written */
+  glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glUseProgram(0);
+}
+
+const void *OcclusionCuller::cmd(int i, Phase phase) {
+  size_t index = phase == PHASE_1 ? i : num_models + i;
+  return (const void *)(uintptr_t)(index * sizeof(DrawCmd));
+}
+
@@ -1,5 +1,6 @@
 #include <glad/glad.h>
 #include <glm/glm.hpp>
+#include "mat.hpp"
 #include "types.hpp"
 #include "helpers.h"
 
@@ -26,7 +27,7 @@ const GLfloat *Orientation::view() {
 
   // M_cam = [ u v w e ]^-1, where u, v, w are
   // vec4 with the 4th index set to 0.
-  view_ = glm::inverse(glm::mat4(
+  view_ = mat::rigid_inverse(glm::mat4(
     glm::vec4(u,0),
     glm::vec4(v,0),
     glm::vec4(w,0),
@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <glad/glad.h>
+
+#include "types.hpp"
+
+
+PassTimer::PassTimer(bool e)
+  : enabled(e)
+  , frames(0)
+  , csv_header(true)
+{
+  int i;
+  for (i=0; i<RING; i++) {
+    slots[i].used = 0;
+  }
+}
+
+PassTimer::~PassTimer() {
+  int i;
+  for (i=0; i<RING; i++) {
+    for (Zone &z : slots[i].zones) {
+      glDeleteQueries(2, z.queries);
+    }
+  }
+}
+
+void PassTimer::frame() {
+  if (!enabled) {
+    return;
+  }
+
+  frames++;
+  Slot &slot = slots[frames % RING];
+  if (slot.used > 0) {
+    /* Timestamps complete in order: the last one covers them all */
+    GLint available = 0;
+    glGetQueryObjectiv(slot.zones[slot.used-1].queries[1],
+                       GL_QUERY_RESULT_AVAILABLE,
+                       &available);
+
+    size_t i;
+    for (i=0; available && i<slot.used; i++) {
+      Zone &z = slot.zones[i];
+      GLuint64 t0, t1;
+      glGetQueryObjectui64v(z.queries[0], GL_QUERY_RESULT, &t0);
+      glGetQueryObjectui64v(z.queries[1], GL_QUERY_RESULT, &t1);
+
+      Stats &s = passes[z.pass];
+      s.last_gpu_ms = (double)(t1 - t0) / 1e6;
+      s.last_cpu_ms = z.cpu_ms;
+      s.gpu_ms += (s.last_gpu_ms - s.gpu_ms) / (s.samples + 1);
+      s.cpu_ms += (s.last_cpu_ms - s.cpu_ms) / (s.samples + 1);
+      s.samples++;
+    }
+  }
+  slot.used = 0;
+}
+
+void PassTimer::begin(const std::string &name) {
+  if (!enabled) {
+    return;
+  }
+
+  if (ids.count(name) == 0) {
+    ids[name] = (int)passes.size();
+    Stats s = {name, 0.0, 0.0, 0.0, 0.0, 0};
+    passes.push_back(s);
+  }
+
+  Slot &slot = slots[frames % RING];
+  if (slot.used == slot.zones.size()) {
+    Zone z;
+    glGenQueries(2, z.queries);
+    slot.zones.push_back(z);
+  }
+
+  Zone &z = slot.zones[slot.used];
+  z.pass = ids[name];
+  glQueryCounter(z.queries[0], GL_TIMESTAMP);
+
+  open.push_back(slot.used++);
+  started.push_back(clock::now());
+}
+
+void PassTimer::end() {
+  if (!enabled || open.empty()) {
+    return;
+  }
+
+  Zone &z = slots[frames % RING].zones[open.back()];
+  glQueryCounter(z.queries[1], GL_TIMESTAMP);
+
+  std::chrono::duration<double, std::milli> ms = 
+    clock::now() - started.back();
+  z.cpu_ms = ms.count();
+
+  open.pop_back();
+  started.pop_back();
+}
+
+void PassTimer::reset() {
+  for (Stats &s : passes) {
+    s.gpu_ms = s.cpu_ms = 0.0;
+    s.samples = 0;
+  }
+}
+
+void PassTimer::print(FILE *f) {
+  fprintf(f, "%-20s %10s %10s %8s\n", "pass", "gpu ms", "cpu ms", "samples");
+  for (const Stats &s : passes) {
+    if (s.samples == 0) {
+      continue;
+    }
+    fprintf(f, "%-20s %10.3f %10.3f %8d\n", 
+      s.name.c_str(), s.gpu_ms, s.cpu_ms, (int)s.samples);
+  }
+}
+
+void PassTimer::write_csv(FILE *f) {
+  if (csv_header) {
+    fprintf(f, "frame,pass,gpu_ms,cpu_ms,samples\n");
+    csv_header = false;
+  }
+  for (const Stats &s : passes) {
+    if (s.samples == 0) {
+      continue;
+    }
+    fprintf(f, "%ld,%s,%.4f,%.4f,%d\n", 
+      frames, s.name.c_str(), s.gpu_ms, s.cpu_ms, (int)s.samples);
+  }
+  fflush(f);
+}
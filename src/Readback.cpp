@@ -0,0 +1,132 @@
+#include <glad/glad.h>
+
+#include "types.hpp"
+#include "trace.hpp"
+
+
+Readback::Readback(int slots)
+  : stalls(0)
+  , head(0)
+  , tail(0)
+  , in_flight(0)
+{
+  /* Buffers are created on first use, so an idle engine is free */
+  ring.resize(slots);
+  for (Slot &slot : ring) {
+    slot.pbo = 0;
+    slot.capacity = 0;
+    slot.size = 0;
+    slot.fence = 0;
+  }
+}
+
+Readback::~Readback() {
+  flush();
+  for (Slot &slot : ring) {
+    if (slot.pbo != 0) {
+      glDeleteBuffers(1, &slot.pbo);
+    }
+  }
+}
+
+Readback::Slot &Readback::acquire(size_t size) {
+  if (in_flight == ring.size()) {
+    deliver(true);
+  }
+
+  Slot &slot = ring[head];
+  if (slot.pbo == 0) {
+    glGenBuffers(1, &slot.pbo);
+  }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+  if (slot.capacity < size) {
+    glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+    slot.capacity = size;
+  }
+  slot.size = size;
+  return slot;
+}
+
+void Readback::submit(Slot &slot, const Callback &done) {
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  slot.done = done;
+  head = (head + 1) % ring.size();
+  in_flight++;
+}
+
+void Readback::read_pixels(GLuint FBO, GLenum mode,
+                           int width, int height,
+                           GLenum format, GLenum type, size_t size,
+                           const Callback &done) {
+  Slot &slot = acquire(size);
+
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, FBO);
+  glReadBuffer(mode);
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  /* Into the bound pack buffer: returns once the copy is queued */
+  glReadPixels(0, 0, width, height, format, type, 0);
+  glPixelStorei(GL_PACK_ALIGNMENT, 4);
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+
+  submit(slot, done);
+}
+
+void Readback::read_texture(GLuint tex, int layer,
+                            int width, int height,
+                            GLenum format, GLenum type, size_t size,
+                            const Callback &done) {
+  Slot &slot = acquire(size);
+
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  glGetTextureSubImage(tex, 0,
+                       0, 0, layer,
+                       width, height, 1,
+                       format, type,
+                       (GLsizei)size, 0);
+  glPixelStorei(GL_PACK_ALIGNMENT, 4);
+
+  submit(slot, done);
+}
+
+bool Readback::deliver(bool wait) {
+  if (in_flight == 0) {
+    return false;
+  }
+
+  Slot &slot = ring[tail];
+  GLenum status = glClientWaitSync(slot.fence,
+                                   GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+  if (status == GL_TIMEOUT_EXPIRED) {
+    if (!wait) {
+      return false;
+    }
+    TRACE_ZONE("readback stall");
+    stalls++;
+    glClientWaitSync(slot.fence, 0, GL_TIMEOUT_IGNORED);
+  }
+  glDeleteSync(slot.fence);
+  slot.fence = 0;
+
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+  const unsigned char *data = (const unsigned char *)
+    glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, slot.size, GL_MAP_READ_BIT);
+  slot.done(data, slot.size);
+  glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  slot.done = Callback();
+
+  tail = (tail + 1) % ring.size();
+  in_flight--;
+  return true;
+}
+
+void Readback::poll() {
+  while (deliver(false)) {
+  }
+}
+
+void Readback::flush() {
+  while (deliver(true)) {
+  }
+}
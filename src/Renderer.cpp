@@ -0,0 +1,415 @@
+#include <stdio.h>
+#include <functional>
+#include <algorithm>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "types.hpp"
+#include "lib.hpp"
+#include "cull.hpp"
+#include "trace.hpp"
+
+#define _DEBUG_LOOP_LOGS_ 0
+#define FRAGMENT_STATS_FRAMES 300 /* Report shaded fragments this often */
+#define TEXTURE_UPLOAD_BUDGET (16 << 20) /* Bytes streamed in per frame */
+
+#define FORWARD_VS "../glsl/model-view-proj.vs"
+#define FORWARD_FS "../glsl/per-frag-blinn-phong.fs"
+#define CLUSTERED_VS "../glsl/clustered.vs"
+#define CLUSTERED_FS "../glsl/clustered.fs"
+#define FORWARD_MAX_LIGHTS 4 /* MAX_NUM_LIGHTS of the forward shaders */
+
+/*
+ * The tightest forward program for a draw batch: the scene's light
+ * count, shadow settings and whether the models have a texture are
+ * compiled in, so the shaders run without those branches.
+ */
+static std::string forward_defines(const Scene &scene, bool textured) {
+  char defines[256];
+  snprintf(defines, sizeof(defines),
+    "#define NUM_LIGHTS %d\n"
+    "#define TEXTURED %d\n"
+    "#define SHADOWS %d\n"
+    "#define SHADOW_FILTER %d\n",
+    std::min((int)scene.lights_.size(), FORWARD_MAX_LIGHTS),
+    textured ? 1 : 0,
+    scene.shadows ? 1 : 0,
+    scene.shadow_pcf ? 1 : 0);
+  return defines;
+}
+
+
+Renderer::Renderer(Scene &scene, int w, int h, bool off)
+  : width(w)
+  , height(h)
+  , offscreen(off)
+  , forward(NULL)
+  , clusters(NULL)
+  , gbuffer(NULL)
+  , target(NULL)
+  , occlusion(NULL)
+  , depth_tex(0)
+  , timer(scene.profile)
+{
+  /*
+   * Note: we do not need the M_vp (i.e. viewport transformation)
+   * because OpenGL does this automatically for us in the
+   * vertex processing stage (right after the vertex shader).
+   * It applies the viewport transformation since it knows 
+   * the screen width, height, and depth of our vertices.
+   */
+  if (scene.deferred) {
+    /* Shades from the cluster light lists, whatever "lighting" says */
+    prog_id = 0;
+    gbuffer = new GBuffer(width, height);
+    clusters = new ClusterGrid(width, height);
+  } else if (scene.clustered) {
+    prog_id = load_shaders_simple(CLUSTERED_VS, CLUSTERED_FS);
+    clusters = new ClusterGrid(width, height);
+  } else {
+    prog_id = 0;
+    forward = new ShaderVariants(FORWARD_VS, FORWARD_FS);
+  }
+
+  /*
+   * Occlusion culling needs the depth of the main pass as a
+   * texture, so the main pass goes to an offscreen target which
+   * is blitted to the window at the end of the frame. The deferred
+   * path has it in the G-buffer already. Offscreen rendering
+   * always has a target, and the frame stays in it.
+   */
+  if (offscreen || (scene.occlusion_culling && gbuffer == NULL)) {
+    target = new RenderTarget(width, height);
+  }
+  if (scene.occlusion_culling) {
+    depth_tex = gbuffer != NULL ? gbuffer->depth : target->depth;
+    occlusion = new OcclusionCuller(width, height);
+    occlusion->upload(scene);
+  }
+
+  glEnable(GL_DEPTH_TEST);
+  glEnable(GL_CULL_FACE);
+  glCullFace(GL_BACK);
+}
+
+void Renderer::prefetch_programs(const Scene &scene) {
+  if (scene.deferred) {
+    GBuffer::prefetch_programs();
+  } else if (scene.clustered) {
+    prefetch_shaders_simple(CLUSTERED_VS, CLUSTERED_FS);
+  } else {
+    /* Untextured batches are rarer, they compile on first use */
+    ShaderVariants::prefetch(FORWARD_VS, FORWARD_FS,
+                             forward_defines(scene, true));
+  }
+  if (scene.occlusion_culling) {
+    OcclusionCuller::prefetch_programs();
+  }
+}
+
+Renderer::~Renderer() {
+  if (prog_id != 0) {
+    glDeleteProgram(prog_id);
+  }
+  delete forward;
+  delete clusters;
+  delete gbuffer;
+  delete occlusion;
+  delete target;
+
+  /* E.g. forward variants no batch ended up drawing with */
+  discard_prefetched_shaders();
+}
+
+bool Renderer::update(Scene &scene) {
+  /* Picks up models moved since the last frame, static ones are free */
+  scene.update_transforms();
+  bool moved = scene.update_bounds();
+
+  /* Shadows and occlusion bounds of moved models are stale */
+  if (moved) {
+    if (occlusion != NULL) {
+      occlusion->update_bounds(scene);
+    }
+    scene.shadowMap->render(scene, &timer);
+    glEnable(GL_DEPTH_TEST);
+    glEnable(GL_CULL_FACE);
+    glCullFace(GL_BACK);
+  }
+
+  /* A texture which finished streaming in changes the frame too */
+  bool uploaded = scene.streamer->poll(TEXTURE_UPLOAD_BUDGET);
+  return moved || uploaded;
+}
+
+void Renderer::render(Scene &scene) {
+  TRACE_ZONE("render");
+  timer.begin("main");
+  if (target != NULL) {
+    target->bind();
+  }
+  glClearColor(46.0f/255.0f, 56.0f/255.0f, 71.0f/255.0f, 1.0f);
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+  Orientation *orient = scene.orient;
+  orient->perspective(width, height);
+  orient->view();
+  glm::mat4 viewProj = orient->per_ * orient->view_;
+
+  /* Only draw models whose bounds intersect the camera frustum */
+  {
+    TRACE_ZONE("cull");
+    scene.cull_models(cull::frustum(viewProj), visible);
+  }
+
+  /*
+   * Submit every visible model, through both occlusion phases 
+   * when occlusion culling is on. The culling dispatches switch
+   * programs, so "restore" makes the pass's own current again
+   * for phase 2.
+   */
+  auto draw_visible = [&](const std::function<void()> &restore, 
+                          const std::function<void(Model *)> &bind) {
+    if (occlusion == NULL) {
+      for (int i : visible) {
+        Model *model = scene.models[i];
+        bind(model);
+        glDrawArrays(GL_TRIANGLES, 0, model->data_->size());
+      }
+      return;
+    }
+
+    /* Phase 1: whatever was visible last frame */
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, occlusion->cmd_buf);
+    for (int i : visible) {
+      bind(scene.models[i]);
+      glDrawArraysIndirect(GL_TRIANGLES, 
+        occlusion->cmd(i, OcclusionCuller::PHASE_1));
+    }
+
+    occlusion->build_hiz(depth_tex);
+    occlusion->cull(viewProj);
+
+    /* Phase 2: models which became visible this frame */
+    restore();
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, occlusion->cmd_buf);
+    for (int i : visible) {
+      bind(scene.models[i]);
+      glDrawArraysIndirect(GL_TRIANGLES, 
+        occlusion->cmd(i, OcclusionCuller::PHASE_2));
+    }
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+  };
+
+  if (gbuffer != NULL) {
+    TRACE_ZONE("deferred");
+    /*
+     * Deferred: rasterize the visible models into the G-buffer,
+     * then light each covered pixel exactly once. The depth
+     * pre-pass has nothing to save here and is skipped.
+     */
+    timer.begin("geometry");
+    gbuffer->begin(scene, viewProj);
+    draw_visible([&]() {
+      glUseProgram(gbuffer->geometry_prog);
+    }, [&](Model *model) {
+      gbuffer->bind_model(model);
+    });
+    timer.end();
+
+    timer.begin("lighting");
+    shaded.begin();
+    gbuffer->shade(scene, *clusters, viewProj, 
+                    target != NULL ? target->fbo : 0);
+    shaded.end();
+    timer.end();
+  } else {
+    TRACE_ZONE("forward");
+    /*
+     * Depth pre-pass: the shadow map's position-only program with
+     * the camera's view-projection in place of the light's. After
+     * it, the depth buffer holds exactly the nearest surfaces, so
+     * the main pass shades each pixel once (GL_EQUAL, no writes).
+     */
+    if (scene.depth_prepass) {
+      timer.begin("depth pre-pass");
+      GLuint depth_prog = scene.shadowMap->prog;
+      glUseProgram(depth_prog);
+      glUniformMatrix4fv(1, 1, GL_FALSE, glm::value_ptr(viewProj));
+      glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+
+      draw_visible([&]() {
+        glUseProgram(depth_prog);
+      }, [](Model *model) {
+        glUniformMatrix4fv(2, 1, GL_FALSE, model->model());
+        glBindVertexArray(model->data_->vao);
+      });
+
+      glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+      glDepthFunc(GL_EQUAL);
+      glDepthMask(GL_FALSE);
+      timer.end();
+    }
+
+    // Bind the shaders
+    timer.begin("shading");
+    if (clusters != NULL) {
+      clusters->update(scene);
+    }
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, scene.shadowMap->tex);
+
+    /*
+     * Forward shading draws the visible models in batches, one per
+     * shader variant (see forward_defines), textured ones first.
+     * Programs and their uniforms change between batches only.
+     */
+    GLuint variants[2] = {0, 0};
+    if (forward != NULL) {
+      std::stable_partition(visible.begin(), visible.end(), [&](int i) {
+        return scene.models[i]->tex_ != NULL;
+      });
+    }
+    auto program = [&](Model *model) {
+      if (forward == NULL) {
+        return prog_id;
+      }
+      int textured = model->tex_ != NULL ? 1 : 0;
+      if (variants[textured] == 0) {
+        variants[textured] = forward->get(forward_defines(scene, textured));
+      }
+      return variants[textured];
+    };
+
+    GLuint current = 0;
+    GLint M_model_id = -1;
+    std::vector<GLuint> ready; /* Uniforms already sent this frame */
+    auto use = [&](GLuint prog) {
+      glUseProgram(prog);
+      current = prog;
+      M_model_id = glGetUniformLocation(prog, "model");
+      if (std::find(ready.begin(), ready.end(), prog) != ready.end()) {
+        return;
+      }
+      ready.push_back(prog);
+
+      GLint M_viewProj_id;
+      GLint ks_id, kd_id, ka_id, Ia_id, p_id;
+      GLint num_lights_id;
+      M_viewProj_id = glGetUniformLocation(prog, "viewProj");
+      ks_id = glGetUniformLocation(prog, "ks");
+      kd_id = glGetUniformLocation(prog, "kd");
+      ka_id = glGetUniformLocation(prog, "ka");
+      Ia_id = glGetUniformLocation(prog, "Ia");
+      p_id = glGetUniformLocation(prog, "p");
+      num_lights_id = glGetUniformLocation(prog, "num_lights");
+
+      // Send uniform variables to device
+      glUniformMatrix4fv(M_viewProj_id, 1, 
+                         GL_FALSE, 
+                         glm::value_ptr(viewProj));
+      glUniform3fv(ks_id, 1, scene.Ks());
+      glUniform3fv(kd_id, 1, scene.Kd());
+      glUniform3fv(ka_id, 1, scene.Ka());
+      glUniform3fv(Ia_id, 1, scene.Ia());
+      glUniform1f(p_id, scene.p);
+      if (clusters != NULL) {
+        clusters->bind(prog);
+        glUniformMatrix4fv(glGetUniformLocation(prog, "view"), 1,
+                           GL_FALSE, glm::value_ptr(orient->view_));
+        glUniform3fv(glGetUniformLocation(prog, "eye"), 1, 
+                     glm::value_ptr(orient->eye));
+      } else {
+        glUniform1i(num_lights_id, scene.lights_.size());
+        scene.ld_lights_uniform(prog, 
+                               "lights[%d].position",
+                               "lights[%d].intensity",
+                               "lights[%d].shadowMat",
+                               1);
+      }
+
+      GLint shadow_id;
+      shadow_id = glGetUniformLocation(prog, "shadowMaps");
+      glUniform1i(shadow_id, 0);
+
+      GLint tex_id;
+      tex_id = glGetUniformLocation(prog, "tex");
+      glUniform1i(tex_id, 1);
+    };
+
+    auto bind_model = [&](Model *model) {
+      GLuint prog = program(model);
+      if (prog != current) {
+        use(prog);
+      }
+      glUniformMatrix4fv(M_model_id, 1, false, model->model());
+
+      // Bind texture for model
+      if (model->tex_ != NULL) {
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, model->tex_->id);
+      }
+
+      glBindVertexArray(model->data_->vao);
+    };
+
+    shaded.begin();
+    if (!scene.depth_prepass) {
+      draw_visible([&]() {
+        glUseProgram(current);
+      }, bind_model);
+    } else {
+      /*
+       * Visibility was settled by the pre-pass. With occlusion
+       * culling, the phase 1 commands now hold this frame's full
+       * visible set.
+       */
+      if (occlusion != NULL) {
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, occlusion->cmd_buf);
+      }
+      for (int i : visible) {
+        Model *model = scene.models[i];
+        bind_model(model);
+        if (occlusion == NULL) {
+          glDrawArrays(GL_TRIANGLES, 0, model->data_->size());
+        } else {
+          glDrawArraysIndirect(GL_TRIANGLES, 
+            occlusion->cmd(i, OcclusionCuller::PHASE_1));
+        }
+      }
+      glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+      glDepthFunc(GL_LESS);
+      glDepthMask(GL_TRUE);
+    }
+    shaded.end();
+    timer.end();
+  }
+
+  if (shaded.frames >= FRAGMENT_STATS_FRAMES) {
+    printf("Shaded fragments/frame: %llu (%s)\n",
+      (unsigned long long)(shaded.total / shaded.frames),
+      gbuffer != NULL ? "deferred" :
+      scene.depth_prepass ? "depth pre-pass" : "forward");
+    shaded.total = 0;
+    shaded.frames = 0;
+  }
+
+#if _DEBUG_LOOP_LOGS_
+  printf("Drew %d/%d models\n", 
+    (int)visible.size(), (int)scene.models.size());
+#endif
+
+  // Unbind the shaders
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+  glBindVertexArray(0);
+  glUseProgram(0);
+
+  if (target != NULL && !offscreen) {
+    target->blit(0);
+  }
+  timer.end();
+}
@@ -0,0 +1,42 @@
+#include <glad/glad.h>
+
+#include "types.hpp"
+
+
+SampleCounter::SampleCounter()
+  : frame(0)
+  , last(0)
+  , total(0)
+  , frames(0)
+{
+  glGenQueries(RING, queries);
+}
+
+SampleCounter::~SampleCounter() {
+  glDeleteQueries(RING, queries);
+}
+
+void SampleCounter::begin() {
+  /*
+   * The slot about to be reused was issued RING frames ago.
+   * Collect it first if the GPU is done with it, otherwise its
+   * result is dropped rather than waited on.
+   */
+  GLuint q = queries[frame % RING];
+  if (frame >= RING) {
+    GLint available = 0;
+    glGetQueryObjectiv(q, GL_QUERY_RESULT_AVAILABLE, &available);
+    if (available) {
+      glGetQueryObjectui64v(q, GL_QUERY_RESULT, &last);
+      total += last;
+      frames++;
+    }
+  }
+
+  glBeginQuery(GL_SAMPLES_PASSED, q);
+}
+
+void SampleCounter::end() {
+  glEndQuery(GL_SAMPLES_PASSED);
+  frame++;
+}
@@ -1,16 +1,24 @@
 #include <string>
 #include <sstream>
 #include <fstream>
+#include <algorithm>
 #include <nlohmann/json.hpp>
 #include <glm/geometric.hpp>
 #include <glm/mat4x4.hpp>
 #include <glm/glm.hpp>
 
 #include "lib.hpp"
+#include "mat.hpp"
 #include "types.hpp"
 #include "helpers.h"
+#include "trace.hpp"
 
 #define SCENE_DEBUG 1
+
+/* Below this many models a linear SIMD sweep beats walking the tree */
+#define BVH_CULL_THRESHOLD 64
+/* Rebuild the BVH once reinserts have made it this much worse */
+#define BVH_REBUILD_RATIO 1.5f
 using json = nlohmann::json;
 
 
@@ -19,6 +27,7 @@ Scene::Scene(std::string n, int w, int h)
   , WIDTH(w)
   , HEIGHT(h)
 {
+  TRACE_ZONE_DETAIL("Scene", filename);
   std::ifstream ifs(filename);
   if (!ifs.is_open()) {
     printf("Failed to open file: %s\n", filename.c_str());
@@ -28,7 +37,11 @@ Scene::Scene(std::string n, int w, int h)
   std::stringstream buf;
   buf << ifs.rdbuf();
 
-  json j = json::parse(buf.str()); 
+  json j;
+  {
+    TRACE_ZONE("parse json");
+    j = json::parse(buf.str()); 
+  }
 
   // Miscellaneous
   {
@@ -46,6 +59,27 @@ Scene::Scene(std::string n, int w, int h)
     this->Ka_ = parse_vec3(j["Ka"].get<std::string>()); 
     this->Ks_ = parse_vec3(j["Ks"].get<std::string>()); 
     this->p = j["p"].get<int>();
+
+    this->occlusion_culling = j.contains("occlusion_culling") && 
+      j["occlusion_culling"].get<bool>();
+    this->depth_prepass = j.contains("depth_prepass") && 
+      j["depth_prepass"].get<bool>();
+    this->clustered = j.contains("lighting") &&
+      j["lighting"].get<std::string>() == "clustered";
+    this->shadows = !j.contains("shadows") || j["shadows"].get<bool>();
+    this->shadow_pcf = j.contains("shadow_filter") &&
+      j["shadow_filter"].get<std::string>() == "pcf";
+    this->deferred = j.contains("renderer") &&
+      j["renderer"].get<std::string>() == "deferred";
+    this->on_demand = j.contains("on_demand") &&
+      j["on_demand"].get<bool>();
+    this->profile = j.contains("profile") && j["profile"].get<bool>();
+    if (j.contains("profile_csv")) {
+      this->profile_csv = j["profile_csv"].get<std::string>();
+    }
+    this->fps = j.contains("fps") ? j["fps"].get<float>() : 0.0f;
+    this->vsync = j.contains("vsync") && j["vsync"].get<bool>();
+    this->uncapped = j.contains("uncapped") && j["uncapped"].get<bool>();
   }
 
   // Lights
@@ -64,10 +98,26 @@ Scene::Scene(std::string n, int w, int h)
         this->WIDTH,
         this->HEIGHT       
       );
+      if (lightJson.contains("radius")) {
+        light.radius = lightJson["radius"].get<float>();
+      }
       this->lights_.push_back(light); 
     }
   }
 
+  /*
+   * Start compiling every program the frame will need, so the
+   * driver works on them while meshes and textures load below.
+   * After the lights: the forward variants depend on their count
+   */
+  {
+    TRACE_ZONE("prefetch programs");
+    auto programs = j["programs"];
+    prefetch_shaders_simple(programs["shadow-vs"].get<std::string>(),
+                            programs["shadow-fs"].get<std::string>());
+    Renderer::prefetch_programs(*this);
+  }
+
   // Objects
   {
     auto objects = j["objects"];
@@ -92,6 +142,15 @@ Scene::Scene(std::string n, int w, int h)
     auto textures = j["textures"];
     assert(textures.is_array());
 
+    /* Decoded and uploaded in the background, see Renderer::update */
+    this->streamer = new TextureStreamer();
+    this->streamer->mipmaps = !j.contains("mipmaps") ||
+      j["mipmaps"].get<bool>();
+    this->streamer->anisotropy = j.contains("anisotropy") ?
+      j["anisotropy"].get<float>() : 1.0f;
+    this->streamer->compress = !j.contains("texture_compression") ||
+      j["texture_compression"].get<bool>();
+
     std::string id, filename;
     Texture *tex;
     json texJson;
@@ -101,11 +160,61 @@ Scene::Scene(std::string n, int w, int h)
       id = texJson["id"].get<std::string>();
       filename = texJson["filename"].get<std::string>();
 
-      tex = new Texture(filename);
+      tex = new Texture(filename, *this->streamer);
       this->textures[id] = tex;
     }
   }
 
+  // Transform nodes
+  if (j.contains("nodes")) {
+    auto nodes = j["nodes"];
+    assert(nodes.is_array());
+
+    std::unordered_map<std::string, json> byId;
+    int i;
+    for (i=0; i<nodes.size(); i++) {
+      byId[nodes[i]["id"].get<std::string>()] = nodes[i];
+    }
+
+    /*
+     * Nodes may be listed in any order, the hierarchy wants
+     * parents first: add each node after its parent chain.
+     */
+    std::vector<std::string> chain;
+    for (i=0; i<nodes.size(); i++) {
+      std::string id = nodes[i]["id"].get<std::string>();
+      chain.clear();
+      while (this->nodes.count(id) == 0) {
+        if (std::find(chain.begin(), chain.end(), id) != chain.end()) {
+          printf("Cycle in scene nodes at: %s\n", id.c_str());
+          exit(1);
+        }
+        chain.push_back(id);
+        if (!byId[id].contains("parent")) {
+          break;
+        }
+        id = byId[id]["parent"].get<std::string>();
+        if (byId.count(id) == 0) {
+          printf("Unknown parent node: %s\n", id.c_str());
+          exit(1);
+        }
+      }
+
+      while (!chain.empty()) {
+        json &nodeJson = byId[chain.back()];
+        int parent = nodeJson.contains("parent") ? 
+          this->nodes[nodeJson["parent"].get<std::string>()] : -1;
+        this->nodes[chain.back()] = this->hierarchy.add(parent, mat::trs(
+          nodeJson["rotation_deg"].get<float>(),
+          parse_vec3(nodeJson["rotation_axis"].get<std::string>()),
+          parse_vec3(nodeJson["scale"].get<std::string>()),
+          parse_vec3(nodeJson["translate"].get<std::string>())
+        ));
+        chain.pop_back();
+      }
+    }
+  }
+
   // Models
   {
     auto models = j["models"];
@@ -136,8 +245,15 @@ Scene::Scene(std::string n, int w, int h)
         modelJson["scale"].get<std::string>(),
         modelJson["translate"].get<std::string>()
       );
+      if (modelJson.contains("parent")) {
+        std::string parent = modelJson["parent"].get<std::string>();
+        assert(this->nodes.count(parent) == 1);
+        model->set_node(this->nodes[parent]);
+      }
       this->models.push_back(model);
     }
+    update_transforms();
+    update_bounds();
   }
 
   // Shadow Map
@@ -149,8 +265,7 @@ Scene::Scene(std::string n, int w, int h)
     nfs = programs["shadow-fs"].get<std::string>();
 
     this->shadowMap = new ShadowMap(
-      this->lights_,
-      this->models,
+      *this,
       this->WIDTH, this->HEIGHT,
       nvs, nfs
     );
@@ -162,6 +277,70 @@ const GLfloat *Scene::Ka() {return (const GLfloat *)&Ka_; }
 const GLfloat *Scene::Ks() {return (const GLfloat *)&Ks_; }
 const GLfloat *Scene::Ia() {return (const GLfloat *)&Ia_; }
 
+/*
+ * Push changed node world matrices down to the models hanging
+ * off them. Models whose node did not change are left alone.
+ */
+void Scene::update_transforms() {
+  TRACE_ZONE("update_transforms");
+  hierarchy.update();
+
+  int i;
+  for (i=0; i<models.size(); i++) {
+    int node = models[i]->node();
+    if (node >= 0 && hierarchy.updated(node)) {
+      models[i]->set_parent(hierarchy.world(node));
+    }
+  }
+}
+
+/*
+ * Recompute the world space bounds of the models which moved since
+ * the last call. Culling passes index into these by model index.
+ * Returns whether any model moved.
+ */
+bool Scene::update_bounds() {
+  TRACE_ZONE("update_bounds");
+  bool build = bounds.size() != models.size();
+  bounds.resize(models.size());
+
+  glm::vec3 c, e;
+  bool moved = build;
+  bool reinserted = false;
+  int i;
+  for (i=0; i<models.size(); i++) {
+    if (!build && !models[i]->moved()) {
+      continue;
+    }
+    moved = true;
+    models[i]->bounds(c, e);
+    bounds.set(i, c, e);
+    if (!build) {
+      reinserted |= bvh.update(i, c, e);
+    }
+  }
+
+  if (build) {
+    bvh.build(bounds);
+  } else if (reinserted && 
+             bvh.sah_cost() > BVH_REBUILD_RATIO * bvh.built_cost) {
+    bvh.rebuild();
+  }
+  return moved;
+}
+
+/*
+ * Indices of the models whose bounds intersect the frustum. The
+ * BVH returns them in tree order, the linear sweep in index order.
+ */
+void Scene::cull_models(const cull::Frustum &f, std::vector<int> &visible) {
+  if (models.size() < BVH_CULL_THRESHOLD) {
+    cull::frustum_cull(bounds, f, visible);
+  } else {
+    bvh.query_frustum(f, visible);
+  }
+}
+
 void Scene::ld_lights_uniform(const GLuint prog,
                               const char *posFmtStr,
                               const char *intensityFmtStr,
@@ -0,0 +1,48 @@
+#include <glad/glad.h>
+
+#include "types.hpp"
+#include "lib.hpp"
+#include "trace.hpp"
+
+static std::vector<ShaderProg> variant_progs(const std::string &vs,
+                                             const std::string &fs,
+                                             const std::string &defines) {
+  std::vector<ShaderProg> progs;
+  progs.push_back(ShaderProg(vs, GL_VERTEX_SHADER, defines));
+  progs.push_back(ShaderProg(fs, GL_FRAGMENT_SHADER, defines));
+  return progs;
+}
+
+ShaderVariants::ShaderVariants(std::string v, std::string f)
+  : vs(v)
+  , fs(f)
+{
+}
+
+ShaderVariants::~ShaderVariants() {
+  for (auto &p : programs) {
+    if (p.second != 0) {
+      glDeleteProgram(p.second);
+    }
+  }
+}
+
+void ShaderVariants::prefetch(const std::string &vs,
+                              const std::string &fs,
+                              const std::string &defines) {
+  prefetch_shaders(variant_progs(vs, fs, defines));
+}
+
+GLuint ShaderVariants::get(const std::string &defines) {
+  auto it = programs.find(defines);
+  if (it != programs.end()) {
+    return it->second;
+  }
+
+  TRACE_ZONE("compile variant");
+  /* A failed variant stays 0, so it is reported only once */
+  GLuint prog = 0;
+  bind_shaders(variant_progs(vs, fs, defines), prog);
+  programs[defines] = prog;
+  return prog;
+}
@@ -3,18 +3,25 @@
 #include <glad/glad.h>
 #include "lib.hpp"
 #include "types.hpp"
+#include "cull.hpp"
+#include "trace.hpp"
 
 #define SCENE_DEBUG 1 
 
 GLenum ShadowMap::DRAW_BUFFERS[1] = {GL_DEPTH_ATTACHMENT};
 
-ShadowMap::ShadowMap(std::vector<Light> &lights,
-                     std::vector<Model *> &models,
+ShadowMap::ShadowMap(Scene &scene,
                      int width,
                      int height,
 					           std::string nvs,
                      std::string nfs) 
+  : width(width)
+  , height(height)
+  , renders(0)
 {
+  TRACE_ZONE("ShadowMap");
+  std::vector<Light> &lights = scene.lights_;
+
   glGenTextures(1, &tex);
   glBindTexture(GL_TEXTURE_2D_ARRAY, tex);
   glTexStorage3D(GL_TEXTURE_2D_ARRAY,
@@ -58,13 +65,42 @@ ShadowMap::ShadowMap(std::vector<Light> &lights,
 
   glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
 
-  GLuint prog = load_shaders_simple(nvs, nfs); 
+  prog = load_shaders_simple(nvs, nfs); 
   glGenFramebuffers(1, &fbo);
+
+  render(scene);
+}
+
+/*
+ * Render the depth of every model visible from each light into
+ * that light's layer of the shadow map array texture.
+ */
+void ShadowMap::render(Scene &scene, PassTimer *timer)
+{
+  TRACE_ZONE("shadow maps");
+  std::vector<Light> &lights = scene.lights_;
+  std::vector<Model *> &models = scene.models;
+
   glBindFramebuffer(GL_FRAMEBUFFER, fbo);
 
+#if SCENE_DEBUG
+  /* Layer i is copied out while layer i+1 renders */
+  Readback readback(lights.size() > 0 ? lights.size() : 1);
+#endif
+
   /* Iniitalize program outside */
   for (int i=0; i<lights.size(); ++i) {
     Light &light = lights[i];
+    glm::mat4 Mvp = light.Mvp();
+
+    /* Models outside of this light's frustum never reach its layer */
+    scene.cull_models(cull::frustum(Mvp), visible);
+
+    if (timer != NULL) {
+      char pass[30];
+      snprintf(pass, 30, "shadow layer %d", i);
+      timer->begin(pass);
+    }
 
     glUseProgram(prog);
     glFramebufferTextureLayer(GL_FRAMEBUFFER,
@@ -80,8 +116,9 @@ ShadowMap::ShadowMap(std::vector<Light> &lights,
     glEnable(GL_CULL_FACE);
     glCullFace(GL_FRONT);
 
-    glUniformMatrix4fv(1, 1, false, glm::value_ptr(light.Mvp()));
-    for (Model *&model : models) {
+    glUniformMatrix4fv(1, 1, false, glm::value_ptr(Mvp));
+    for (int m : visible) {
+      Model *model = models[m];
       glUniformMatrix4fv(2, 1, false, model->model());
       glBindVertexArray(model->data_->vao);
       glDrawArrays(GL_TRIANGLES, 0, model->data_->size());
@@ -93,12 +130,21 @@ ShadowMap::ShadowMap(std::vector<Light> &lights,
     glDisable(GL_CULL_FACE);
     glUseProgram(0);
 
+    if (timer != NULL) {
+      timer->end();
+    }
+
 #if SCENE_DEBUG
+    /* Only the initial render, not every time a model moves */
+    if (renders > 0) {
+      continue;
+    }
     char screenshot_filename[30];
     snprintf(screenshot_filename, 30, "../shadow_map_%d.tga", i);
 
     using namespace screen;
-    depth_3D_layer_screenshot(tex,
+    depth_3D_layer_screenshot(readback,
+                              tex,
                               width,
                               height,
                               i, /* Layer # */
@@ -107,4 +153,5 @@ ShadowMap::ShadowMap(std::vector<Light> &lights,
   }
 
   glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  renders++;
 }
\ No newline at end of file
@@ -5,9 +5,11 @@
 #include "types.hpp"
 #include "mat.hpp"
 #include "lib.hpp"
+#include "trace.hpp"
 
 
 Texture::Texture(std::string f) : file(f) {
+  TRACE_ZONE_DETAIL("Texture", file);
   glGenTextures(1, &id);
   data = load_tex(file, width, height);
   glBindTexture(GL_TEXTURE_2D, id);
@@ -34,11 +36,21 @@ Texture::Texture(std::string f) : file(f) {
 }
 
 
+Texture::Texture(std::string f, TextureStreamer &streamer) 
+  : file(f)
+  , width(0)
+  , height(0)
+{
+  streamer.load(this);
+}
+
 Texture::Texture() {}
 
 Texture::~Texture() {
   if (data != NULL) {
     free(data);
   }
-  glDeleteTextures(1, &id);
+  if (id != TextureStreamer::placeholder()) {
+    glDeleteTextures(1, &id);
+  }
 }
@@ -0,0 +1,433 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <algorithm>
+#include <glad/glad.h>
+
+#include "types.hpp"
+#include "lib.hpp"
+#include "bc1.hpp"
+#include "pixels.hpp"
+#include "trace.hpp"
+
+#define PLACEHOLDER_GREY 128
+
+static inline int level_size(int size, int level) {
+  return std::max(size >> level, 1);
+}
+
+static GLuint alloc_tex(GLenum format, int width, int height,
+                        int levels, float anisotropy) {
+  GLuint tex;
+  glGenTextures(1, &tex);
+  glBindTexture(GL_TEXTURE_2D, tex);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                  levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+  if (anisotropy > 1.0f && (GLAD_GL_ARB_texture_filter_anisotropic ||
+                            GLAD_GL_EXT_texture_filter_anisotropic)) {
+    GLfloat max = 1.0f;
+    glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY, &max);
+    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY,
+                    std::min(anisotropy, max));
+  }
+  glTexStorage2D(GL_TEXTURE_2D, levels, format, width, height);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  return tex;
+}
+
+static size_t level_bytes(GLenum format, int width, int height) {
+  return format == GL_RGB8 ? 3 * (size_t)width * height :
+                             bc1::size(width, height);
+}
+
+/* A chain from the cache must be what the key says it is */
+static bool cached_chain_ok(const texture_cache::Image &image,
+                            bool mipmaps) {
+  if (image.format != GL_COMPRESSED_RGB_S3TC_DXT1_EXT ||
+      image.width <= 0 || image.height <= 0) {
+    return false;
+  }
+  int levels = (int)image.levels.size();
+  if (mipmaps ? level_size(image.width, levels - 1) > 1 ||
+                level_size(image.height, levels - 1) > 1 :
+                levels != 1) {
+    return false;
+  }
+  int l;
+  for (l=0; l<levels; l++) {
+    if (image.sizes[l] != level_bytes(image.format,
+                                      level_size(image.width, l),
+                                      level_size(image.height, l))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/*
+ * On a worker: "u.image" and the memory behind it, from the cache
+ * when possible, otherwise decoded, filtered down and encoded.
+ */
+void TextureStreamer::decode(Upload &u) {
+  texture_cache::Image &image = u.image;
+  uint64_t key = 0;
+  if (u.compress) {
+    key = texture_cache::key(u.tex->file,
+                             GL_COMPRESSED_RGB_S3TC_DXT1_EXT, u.mipmaps);
+    if (texture_cache::load(key, image)) {
+      if (cached_chain_ok(image, u.mipmaps)) {
+        return;
+      }
+      texture_cache::release(image);
+    }
+  }
+
+  int width, height;
+  u.data = load_tex(u.tex->file, width, height);
+  image.format = GL_RGB8;
+  image.width = width;
+  image.height = height;
+  image.map = NULL;
+
+  int levels = 1;
+  if (u.mipmaps) {
+    while (level_size(width, levels - 1) > 1 ||
+           level_size(height, levels - 1) > 1) {
+      levels++;
+    }
+  }
+
+  /* Sizes first: "levels" points into "mips", which must not grow */
+  size_t total = 0;
+  int l;
+  for (l=1; l<levels; l++) {
+    total += level_bytes(GL_RGB8, level_size(width, l),
+                                  level_size(height, l));
+  }
+  u.mips.resize(total);
+  image.levels.push_back(u.data);
+  image.sizes.push_back(level_bytes(GL_RGB8, width, height));
+  size_t offset = 0;
+  for (l=1; l<levels; l++) {
+    TRACE_ZONE_DETAIL("mipmaps", u.tex->file);
+    unsigned char *dst = u.mips.data() + offset;
+    pixels::downsample(image.levels[l-1],
+                       level_size(width, l-1),
+                       level_size(height, l-1),
+                       3, dst);
+    image.levels.push_back(dst);
+    image.sizes.push_back(level_bytes(GL_RGB8, level_size(width, l),
+                                               level_size(height, l)));
+    offset += image.sizes[l];
+  }
+
+  if (!u.compress) {
+    return;
+  }
+
+  TRACE_ZONE_DETAIL("bc1", u.tex->file);
+  texture_cache::Image blocks = image;
+  blocks.format = GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+  total = 0;
+  for (l=0; l<levels; l++) {
+    blocks.sizes[l] = level_bytes(blocks.format, level_size(width, l),
+                                                 level_size(height, l));
+    total += blocks.sizes[l];
+  }
+  std::vector<unsigned char> encoded(total);
+  offset = 0;
+  for (l=0; l<levels; l++) {
+    bc1::encode(image.levels[l],
+                level_size(width, l),
+                level_size(height, l),
+                encoded.data() + offset);
+    blocks.levels[l] = encoded.data() + offset;
+    offset += blocks.sizes[l];
+  }
+  texture_cache::store(key, blocks);
+
+  /* The RGB chain is not needed past this point */
+  free(u.data);
+  u.data = NULL;
+  u.mips.swap(encoded);
+  image = blocks;
+}
+
+GLuint TextureStreamer::placeholder() {
+  static GLuint tex = 0;
+  if (tex == 0) {
+    unsigned char grey[3] = {
+      PLACEHOLDER_GREY, PLACEHOLDER_GREY, PLACEHOLDER_GREY
+    };
+    tex = alloc_tex(GL_RGB8, 1, 1, 1, 1.0f);
+    glBindTexture(GL_TEXTURE_2D, tex);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 1, 1,
+                    GL_RGB, GL_UNSIGNED_BYTE, grey);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glBindTexture(GL_TEXTURE_2D, 0);
+  }
+  return tex;
+}
+
+TextureStreamer::TextureStreamer(int threads, int slots, size_t size)
+  : stalls(0)
+  , mipmaps(true)
+  , anisotropy(1.0f)
+  , compress(true)
+  , mapped(NULL)
+  , slot_size(size)
+  , head(0)
+  , active(false)
+  , outstanding(0)
+  , stop(false)
+{
+  ring.resize(slots);
+  int i;
+  for (i=0; i<slots; i++) {
+    ring[i].offset = i * slot_size;
+    ring[i].fence = 0;
+  }
+
+  /*
+   * Mapped once for good where buffer storage is available (GL
+   * 4.4); otherwise each slot is mapped unsynchronized while it is
+   * written, the fences doing the synchronization either way.
+   */
+  GLsizeiptr total = (GLsizeiptr)(slots * slot_size);
+  glGenBuffers(1, &pbo);
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+  if (GLAD_GL_ARB_buffer_storage) {
+    GLbitfield flags = GL_MAP_WRITE_BIT |
+                       GL_MAP_PERSISTENT_BIT |
+                       GL_MAP_COHERENT_BIT;
+    glBufferStorage(GL_PIXEL_UNPACK_BUFFER, total, NULL, flags);
+    mapped = (unsigned char *)
+      glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, total, flags);
+  } else {
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, total, NULL, GL_STREAM_DRAW);
+  }
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+  for (i=0; i<threads; i++) {
+    workers.push_back(std::thread(&TextureStreamer::run, this));
+  }
+}
+
+TextureStreamer::~TextureStreamer() {
+  {
+    std::unique_lock<std::mutex> l(lock);
+    stop = true;
+    queue.clear();
+  }
+  queued.notify_all();
+  for (std::thread &t : workers) {
+    t.join();
+  }
+
+  /* Never uploaded, those textures keep the placeholder */
+  for (Upload &u : decoded) {
+    texture_cache::release(u.image);
+    free(u.data);
+  }
+  if (active) {
+    glDeleteTextures(1, &current.id);
+    texture_cache::release(current.image);
+    free(current.data);
+  }
+
+  for (Slot &slot : ring) {
+    if (slot.fence != 0) {
+      glDeleteSync(slot.fence);
+    }
+  }
+  if (mapped != NULL) {
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  }
+  glDeleteBuffers(1, &pbo);
+}
+
+void TextureStreamer::load(Texture *tex) {
+  tex->id = placeholder();
+  outstanding++;
+
+  Upload u;
+  u.tex = tex;
+  u.data = NULL;
+  u.image.map = NULL;
+  u.mipmaps = mipmaps;
+  u.compress = compress && GLAD_GL_EXT_texture_compression_s3tc;
+  u.anisotropy = anisotropy;
+  u.id = 0;
+  u.level = 0;
+  u.row = 0;
+  {
+    std::unique_lock<std::mutex> l(lock);
+    queue.push_back(u);
+  }
+  queued.notify_one();
+}
+
+bool TextureStreamer::poll(size_t budget) {
+  return upload(budget, false);
+}
+
+void TextureStreamer::flush() {
+  TRACE_ZONE("texture flush");
+  while (outstanding > 0) {
+    if (!active) {
+      std::unique_lock<std::mutex> l(lock);
+      ready.wait(l, [this] { return !decoded.empty(); });
+    }
+    upload(SIZE_MAX, true);
+  }
+}
+
+bool TextureStreamer::upload(size_t budget, bool wait) {
+  bool completed = false;
+  size_t sent = 0;
+  while (sent < budget) {
+    if (!active) {
+      std::unique_lock<std::mutex> l(lock);
+      if (decoded.empty()) {
+        break;
+      }
+      current = std::move(decoded.front());
+      decoded.pop_front();
+      active = true;
+    }
+    const texture_cache::Image &image = current.image;
+    int levels = (int)image.levels.size();
+    if (current.id == 0) {
+      current.id = alloc_tex(image.format, image.width, image.height,
+                             levels, current.anisotropy);
+    }
+
+    TRACE_ZONE_DETAIL("texture upload", current.tex->file);
+    int width = level_size(image.width, current.level);
+    int height = level_size(image.height, current.level);
+
+    /* BC1 goes up in rows of 4x4 blocks */
+    bool compressed = image.format != GL_RGB8;
+    int unit = compressed ? 4 : 1;
+    int units = (height + unit - 1) / unit;
+    size_t row_size = compressed ? bc1::size(width, 1) :
+                                   3 * (size_t)width;
+    int rows = std::min(units - current.row,
+                        (int)(slot_size / row_size));
+    const unsigned char *src = image.levels[current.level] +
+                               current.row * row_size;
+
+    /* "rows" rows from "pixels", client memory or unpack buffer */
+    auto sub_image = [&](int rows, const void *pixels) {
+      int y = current.row * unit;
+      int h = std::min(rows * unit, height - y);
+      if (compressed) {
+        glCompressedTexSubImage2D(GL_TEXTURE_2D, current.level,
+                                  0, y, width, h, image.format,
+                                  (GLsizei)(rows * row_size), pixels);
+      } else {
+        glTexSubImage2D(GL_TEXTURE_2D, current.level, 0, y, width, h,
+                        GL_RGB, GL_UNSIGNED_BYTE, pixels);
+      }
+    };
+
+    glBindTexture(GL_TEXTURE_2D, current.id);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    if (rows == 0) {
+      /* A row bigger than a slot: straight from client memory */
+      rows = units - current.row;
+      sub_image(rows, src);
+    } else {
+      Slot &slot = ring[head];
+      if (slot.fence != 0) {
+        GLenum status = glClientWaitSync(slot.fence,
+                                         GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+        if (status == GL_TIMEOUT_EXPIRED) {
+          if (!wait) {
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+            glBindTexture(GL_TEXTURE_2D, 0);
+            break;
+          }
+          TRACE_ZONE("texture stall");
+          stalls++;
+          glClientWaitSync(slot.fence, 0, GL_TIMEOUT_IGNORED);
+        }
+        glDeleteSync(slot.fence);
+        slot.fence = 0;
+      }
+
+      size_t size = rows * row_size;
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+      if (mapped != NULL) {
+        memcpy(mapped + slot.offset, src, size);
+      } else {
+        void *dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER,
+                                     slot.offset, size,
+                                     GL_MAP_WRITE_BIT |
+                                     GL_MAP_INVALIDATE_RANGE_BIT |
+                                     GL_MAP_UNSYNCHRONIZED_BIT);
+        memcpy(dst, src, size);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+      }
+      /* From the bound unpack buffer: the copy is only queued */
+      sub_image(rows, (const void *)slot.offset);
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+      slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+      head = (head + 1) % ring.size();
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    current.row += rows;
+    sent += rows * row_size;
+    if (current.row == units) {
+      current.level++;
+      current.row = 0;
+    }
+    if (current.level == levels) {
+      /* Later draws come after the upload, so the switch is safe */
+      Texture *tex = current.tex;
+      tex->data = current.data;
+      tex->width = image.width;
+      tex->height = image.height;
+      tex->id = current.id;
+      texture_cache::release(current.image);
+      std::vector<unsigned char>().swap(current.mips);
+      active = false;
+      outstanding--;
+      completed = true;
+    }
+  }
+  return completed;
+}
+
+void TextureStreamer::run() {
+  while (true) {
+    Upload u;
+    {
+      std::unique_lock<std::mutex> l(lock);
+      queued.wait(l, [this] { return stop || !queue.empty(); });
+      if (stop) {
+        return;
+      }
+      u = std::move(queue.front());
+      queue.pop_front();
+    }
+
+    decode(u);
+
+    {
+      std::unique_lock<std::mutex> l(lock);
+      decoded.push_back(std::move(u));
+    }
+    ready.notify_all();
+  }
+}
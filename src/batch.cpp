@@ -0,0 +1,165 @@
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <nlohmann/json.hpp>
+#include <glad/glad.h>
+
+#include "batch.hpp"
+#include "types.hpp"
+#include "helpers.h"
+#include "trace.hpp"
+
+/* Views in flight between glReadPixels and writing them out */
+#define READBACK_SLOTS 3
+#define PROGRESS_VIEWS 100 /* Report progress this often */
+using json = nlohmann::json;
+
+static bool ends_with(const std::string &s, const char *suffix) {
+  size_t n = strlen(suffix);
+  return s.size() >= n && s.compare(s.size() - n, n, suffix) == 0;
+}
+
+static bool load_json(std::ifstream &ifs,
+                      const Orientation &base,
+                      std::vector<Orientation> &cameras) {
+  std::stringstream buf;
+  buf << ifs.rdbuf();
+
+  /* parse() and get() throw on malformed input */
+  try {
+    json j = json::parse(buf.str());
+    if (!j.is_array()) {
+      printf("Camera list must be a JSON array\n");
+      return false;
+    }
+
+    for (auto &c : j) {
+      Orientation o = base;
+      if (c.contains("eye")) {
+        o.eye = parse_vec3(c["eye"].get<std::string>());
+      }
+      if (c.contains("gaze")) {
+        o.gaze = parse_vec3(c["gaze"].get<std::string>());
+      }
+      if (c.contains("top")) {
+        o.top = parse_vec3(c["top"].get<std::string>());
+      }
+      if (c.contains("fovy")) {
+        o.fovy = c["fovy"].get<float>();
+      }
+      o.gaze = glm::normalize(o.gaze);
+      cameras.push_back(o);
+    }
+  } catch (const json::exception &e) {
+    printf("Malformed camera list: %s\n", e.what());
+    return false;
+  }
+  return true;
+}
+
+static bool load_csv(std::ifstream &ifs,
+                     const Orientation &base,
+                     std::vector<Orientation> &cameras) {
+  std::string line;
+  int lineno = 0;
+  while (std::getline(ifs, line)) {
+    lineno++;
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+
+    float v[10];
+    int n = sscanf(line.c_str(),
+                   "%f,%f,%f,%f,%f,%f,%f,%f,%f,%f",
+                   &v[0], &v[1], &v[2], &v[3], &v[4],
+                   &v[5], &v[6], &v[7], &v[8], &v[9]);
+    if (n <= 0 && cameras.empty()) {
+      continue; /* Header */
+    }
+    if (n < 6) {
+      printf("Bad camera on line %d: %s\n", lineno, line.c_str());
+      return false;
+    }
+
+    Orientation o = base;
+    o.eye = glm::vec3(v[0], v[1], v[2]);
+    o.gaze = glm::normalize(glm::vec3(v[3], v[4], v[5]));
+    if (n >= 9) {
+      o.top = glm::vec3(v[6], v[7], v[8]);
+    }
+    if (n >= 10) {
+      o.fovy = v[9];
+    }
+    cameras.push_back(o);
+  }
+  return true;
+}
+
+bool batch::load_cameras(const std::string &filepath,
+                         const Orientation &base,
+                         std::vector<Orientation> &cameras) {
+  TRACE_ZONE_DETAIL("load_cameras", filepath);
+  std::ifstream ifs(filepath);
+  if (!ifs.is_open()) {
+    printf("Failed to open file: %s\n", filepath.c_str());
+    return false;
+  }
+
+  cameras.clear();
+  bool ok = ends_with(filepath, ".csv") ?
+    load_csv(ifs, base, cameras) : load_json(ifs, base, cameras);
+  if (ok && cameras.empty()) {
+    printf("No cameras in %s\n", filepath.c_str());
+    return false;
+  }
+  return ok;
+}
+
+void batch::render(Scene &scene,
+                   Renderer &renderer,
+                   const std::vector<Orientation> &cameras,
+                   const std::string &pattern) {
+  int width = renderer.width;
+  int height = renderer.height;
+
+  /*
+   * Each view is copied into a pixel pack buffer and written out a
+   * couple of views later, while the GPU is busy with the next one.
+   */
+  Readback readback(READBACK_SLOTS);
+  char path[1024];
+
+  /* Shadows and bounds do not depend on the camera */
+  renderer.update(scene);
+
+  auto start = std::chrono::steady_clock::now();
+  int i;
+  for (i=0; i<(int)cameras.size(); i++) {
+    TRACE_ZONE("view");
+    *scene.orient = cameras[i];
+    renderer.timer.frame();
+    renderer.render(scene);
+
+    snprintf(path, sizeof(path), pattern.c_str(), i);
+    screen::color_2D_screenshot(readback,
+                                renderer.target->fbo,
+                                GL_COLOR_ATTACHMENT0,
+                                width, height,
+                                path);
+    readback.poll();
+
+    if ((i+1) % PROGRESS_VIEWS == 0) {
+      printf("Rendered %d/%d views\n", i+1, (int)cameras.size());
+    }
+  }
+  readback.flush();
+  screen::finish();
+
+  double s = std::chrono::duration<double>(
+    std::chrono::steady_clock::now() - start).count();
+  printf("Wrote %d views in %.2f s (%.2f ms/view)\n",
+    (int)cameras.size(), s,
+    1000.0 * s / cameras.size());
+}
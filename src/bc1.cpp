@@ -0,0 +1,166 @@
+#include <string.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+#include "bc1.hpp"
+
+#define PARALLEL_MIN_BLOCKS (1 << 14) /* Smaller levels use one thread */
+#define BLOCK_ROWS 4 /* Rows of blocks a thread encodes at a time */
+#define MAX_THREADS 16
+
+namespace {
+  inline int pack565(int r, int g, int b) {
+    return ((r * 31 + 127) / 255) << 11 |
+           ((g * 63 + 127) / 255) << 5 |
+           ((b * 31 + 127) / 255);
+  }
+
+  inline void unpack565(int c, int *rgb) {
+    int r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+    rgb[0] = (r << 3) | (r >> 2);
+    rgb[1] = (g << 2) | (g >> 4);
+    rgb[2] = (b << 3) | (b >> 2);
+  }
+
+  /*
+   * Endpoints from the bounding box of the block, inset by 1/16 of
+   * its extent against outliers. Of the box's four diagonals, the
+   * one the texels vary along (signs of the red/blue covariance with
+   * green) is used.
+   */
+  void encode_block(const unsigned char texels[16][3],
+                    unsigned char *block) {
+    int lo[3] = {255, 255, 255}, hi[3] = {0, 0, 0};
+    int i, c;
+    for (i=0; i<16; i++) {
+      for (c=0; c<3; c++) {
+        lo[c] = std::min(lo[c], (int)texels[i][c]);
+        hi[c] = std::max(hi[c], (int)texels[i][c]);
+      }
+    }
+
+    int mid[3];
+    for (c=0; c<3; c++) {
+      int inset = (hi[c] - lo[c]) >> 4;
+      lo[c] += inset;
+      hi[c] -= inset;
+      mid[c] = (lo[c] + hi[c]) >> 1;
+    }
+
+    int rg = 0, bg = 0;
+    for (i=0; i<16; i++) {
+      int dg = texels[i][1] - mid[1];
+      rg += (texels[i][0] - mid[0]) * dg;
+      bg += (texels[i][2] - mid[2]) * dg;
+    }
+    if (rg < 0) {
+      std::swap(lo[0], hi[0]);
+    }
+    if (bg < 0) {
+      std::swap(lo[2], hi[2]);
+    }
+
+    int c0 = pack565(hi[0], hi[1], hi[2]);
+    int c1 = pack565(lo[0], lo[1], lo[2]);
+    if (c0 < c1) {
+      std::swap(c0, c1);
+    }
+
+    unsigned int indices = 0;
+    if (c0 != c1) {
+      /* Index 0 and 1 are the endpoints, 2 and 3 the thirds between */
+      int palette[4][3];
+      unpack565(c0, palette[0]);
+      unpack565(c1, palette[1]);
+      for (c=0; c<3; c++) {
+        palette[2][c] = (2*palette[0][c] + palette[1][c]) / 3;
+        palette[3][c] = (palette[0][c] + 2*palette[1][c]) / 3;
+      }
+      for (i=0; i<16; i++) {
+        int best = 0, best_d = 1 << 30, k;
+        for (k=0; k<4; k++) {
+          int d = 0;
+          for (c=0; c<3; c++) {
+            int e = texels[i][c] - palette[k][c];
+            d += e * e;
+          }
+          if (d < best_d) {
+            best_d = d;
+            best = k;
+          }
+        }
+        indices |= (unsigned int)best << (2*i);
+      }
+    }
+    /* else one colour, every index 0 (3 would be black) */
+
+    block[0] = c0 & 0xFF;
+    block[1] = c0 >> 8;
+    block[2] = c1 & 0xFF;
+    block[3] = c1 >> 8;
+    block[4] = indices & 0xFF;
+    block[5] = (indices >> 8) & 0xFF;
+    block[6] = (indices >> 16) & 0xFF;
+    block[7] = indices >> 24;
+  }
+}
+
+size_t bc1::size(int width, int height) {
+  return 8 * (size_t)((width + 3) / 4) * ((height + 3) / 4);
+}
+
+void bc1::encode(const unsigned char *rgb,
+                 int width,
+                 int height,
+                 unsigned char *dst,
+                 int threads) {
+  int bw = (width + 3) / 4;
+  int bh = (height + 3) / 4;
+
+  auto encode_rows = [=](int by0, int by1) {
+    unsigned char texels[16][3];
+    int bx, by, x, y;
+    for (by=by0; by<by1; by++) {
+      for (bx=0; bx<bw; bx++) {
+        for (y=0; y<4; y++) {
+          int sy = std::min(4*by + y, height - 1);
+          for (x=0; x<4; x++) {
+            int sx = std::min(4*bx + x, width - 1);
+            memcpy(texels[4*y + x],
+                   rgb + 3 * ((size_t)sy * width + sx), 3);
+          }
+        }
+        encode_block(texels, dst + 8 * ((size_t)by * bw + bx));
+      }
+    }
+  };
+
+  if (threads <= 0) {
+    threads = (int)std::thread::hardware_concurrency();
+  }
+  threads = std::min(threads, MAX_THREADS);
+  threads = std::min(threads, (bh + BLOCK_ROWS - 1) / BLOCK_ROWS);
+  if ((size_t)bw * bh < PARALLEL_MIN_BLOCKS || threads <= 1) {
+    encode_rows(0, bh);
+    return;
+  }
+
+  std::atomic<int> next(0);
+  auto run = [&]() {
+    int by0;
+    while ((by0 = next.fetch_add(BLOCK_ROWS)) < bh) {
+      encode_rows(by0, std::min(by0 + BLOCK_ROWS, bh));
+    }
+  };
+  std::vector<std::thread> pool;
+  int i;
+  for (i=1; i<threads; i++) {
+    pool.push_back(std::thread(run));
+  }
+  run();
+  for (std::thread &t : pool) {
+    t.join();
+  }
+}
@@ -1,9 +1,21 @@
 #include <fstream>
+#include <sstream>
+#include <thread>
+#include <chrono>
+#include <unordered_map>
 #include <glad/glad.h>
 #include "lib.hpp"
+#include "trace.hpp"
+#include "shader_cache.hpp"
+#include "pixels.hpp"
 
 #include <CImg/CImg.h>
 
+/* Reuse linked program binaries across runs (see shader_cache.hpp) */
+#define SHADER_CACHE 1
+/* Sleep between GL_COMPLETION_STATUS polls of a program being bound */
+#define COMPLETION_POLL_US 100
+
 
 void bind_tex_fbo(const GLuint &TEX, GLuint &FBO) {
   GLuint _FBO;
@@ -143,21 +155,12 @@ void bind_vao(const std::vector<ld_o::VBO_STRUCT> &data, GLuint &VAO) {
   VAO = _VAO;
 }
 
-inline int LOC(int x, int y, int width) {
-  return (y * width + x) * 3;
-}
-
 unsigned char *load_tex(const std::string &filepath,
                         int &width,
-                        int &height) {
+                        int &height,
+                        int channels) {
+  TRACE_ZONE_DETAIL("load_tex", filepath);
   unsigned char *data;
-  /*
-   * Basically we just have to reverse the bytes
-   * to make it bottom up - since OpenGL processes
-   * textures from the bottom-left pixel to the
-   * top-right pixel (rather than top-left to bottom-
-   * right), like usual
-   */
   cimg_library::CImg<unsigned char> img;
   img.load(filepath.c_str());
 
@@ -165,22 +168,18 @@ unsigned char *load_tex(const std::string &filepath,
   int M = clamp_dim(img.width());
   printf("Image loaded: %dx%d\n", N, M);
 
-  data = (unsigned char *)malloc(3*N*M*sizeof(unsigned char));;
-  int x, y, _y;
-  for (y=0, _y=N-1; y<N; y++, _y--) {
-    for (x=0; x<M; x++) {
-      unsigned char r, g, b;
-      int loc = LOC(x,y,M);
-
-      r = img(x, _y, 0, 0);
-      g = img(x, _y, 0, 1);
-      b = img(x, _y, 0, 2);
-
-      data[loc] = r;
-      data[loc+1] = g;
-      data[loc+2] = b;
-    }
-  }
+  /*
+   * Basically we just have to reverse the rows
+   * to make it bottom up - since OpenGL processes
+   * textures from the bottom-left pixel to the
+   * top-right pixel (rather than top-left to bottom-
+   * right), like usual. CImg keeps each channel as
+   * a separate plane, so the channels are interleaved
+   * on the way.
+   */
+  data = (unsigned char *)malloc((size_t)channels*N*M*sizeof(unsigned char));
+  pixels::planar_to_gl(img.data(), img.width(), img.height(),
+                       img.spectrum(), M, N, channels, data);
 
   printf("Image transferred\n");
   width = M;
@@ -188,80 +187,209 @@ unsigned char *load_tex(const std::string &filepath,
   return data;
 }
 
-void bind_shaders(const std::vector<ShaderProg> &shader_progs,
-                  GLuint &prog_id)
-{
-  std::vector<GLuint> shaders;
+/*
+ * A program whose shaders were compiled and linked without asking
+ * for the result yet. Status queries block until the driver is
+ * done, so they wait until the program is bound; meanwhile the
+ * driver's threads compile (GL_KHR_parallel_shader_compile) while
+ * this one loads meshes and textures.
+ */
+typedef struct PendingProgram {
+  GLuint prog;
+  std::vector<GLuint> shaders; /* Empty when loaded from the cache */
+  uint64_t cache_key;
+} PendingProgram;
+
+/* Started by prefetch_shaders(), not bound yet */
+static std::unordered_map<std::string, PendingProgram> pending;
+
+static std::string pending_key(const std::vector<ShaderProg> &shader_progs) {
+  std::ostringstream key;
+  for (const ShaderProg &p : shader_progs) {
+    key << p.type << ':' << p.filename << ':' 
+        << std::hash<std::string>()(p.code) << ';';
+  }
+  return key.str();
+}
+
+static bool parallel_compile() {
+  return GLAD_GL_KHR_parallel_shader_compile ||
+         GLAD_GL_ARB_parallel_shader_compile;
+}
+
+static void enable_parallel_compile() {
+  static bool enabled = false;
+  if (enabled) {
+    return;
+  }
+  enabled = true;
+
+  /* As many compiler threads as the driver cares to use */
+  if (GLAD_GL_KHR_parallel_shader_compile) {
+    glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+  } else if (GLAD_GL_ARB_parallel_shader_compile) {
+    glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+  }
+}
+
+static PendingProgram start_program(const std::vector<ShaderProg> &shader_progs) {
+  enable_parallel_compile();
+
+  PendingProgram p;
+  p.cache_key = 0;
+#if SHADER_CACHE
+  p.cache_key = shader_cache::key(shader_progs);
+  p.prog = shader_cache::load(p.cache_key);
+  if (p.prog != 0) {
+    return p;
+  }
+#endif
 
-  GLuint s;
-  GLint status;
   int i;
   for (i=0; i<shader_progs.size(); i++) {
     const ShaderProg *shader_prog = &shader_progs[i]; 
 
-    s = glCreateShader(shader_prog->type);
+    GLuint s = glCreateShader(shader_prog->type);
     GLchar *code = (GLchar *)shader_prog->code.c_str();
     glShaderSource(s, 1, &code, 0);
     glCompileShader(s);
-     
+    p.shaders.push_back(s);
+  }
+
+  // Link right away, compile errors surface as a failed link
+  p.prog = glCreateProgram();
+  for (GLuint s : p.shaders) {
+    glAttachShader(p.prog, s);
+  }
+#if SHADER_CACHE
+  glProgramParameteri(p.prog, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+#endif
+  glLinkProgram(p.prog);
+  return p;
+}
+
+static void finish_program(PendingProgram &p,
+                           const std::vector<ShaderProg> &shader_progs,
+                           GLuint &prog_id) {
+  if (p.shaders.empty()) {
+    printf("program loaded from cache: %s\n", 
+      shader_progs.empty() ? "" : shader_progs[0].filename.c_str());
+    prog_id = p.prog;
+    return;
+  }
+
+  /*
+   * With parallel compile, ask whether the driver's threads are
+   * done, which never blocks, and only read the status once they
+   * are; without it the status query itself waits for the link.
+   */
+  GLint status;
+  {
+    TRACE_ZONE("link wait");
+    if (parallel_compile()) {
+      GLint done = GL_FALSE;
+      glGetProgramiv(p.prog, GL_COMPLETION_STATUS_KHR, &done);
+      while (!done) {
+        std::this_thread::sleep_for(
+          std::chrono::microseconds(COMPLETION_POLL_US));
+        glGetProgramiv(p.prog, GL_COMPLETION_STATUS_KHR, &done);
+      }
+    }
+    glGetProgramiv(p.prog, GL_LINK_STATUS, &status);
+  }
+
+  bool compiled = true;
+  int i;
+  for (i=0; i<p.shaders.size(); i++) {
     // Check shader compile status
-    glGetShaderiv(s, GL_COMPILE_STATUS, &status);
+    glGetShaderiv(p.shaders[i], GL_COMPILE_STATUS, &status);
     if (!status) {
       GLchar *error_log;
       GLint log_length;
-      glGetShaderiv(s, GL_INFO_LOG_LENGTH, &log_length);
+      glGetShaderiv(p.shaders[i], GL_INFO_LOG_LENGTH, &log_length);
 
       error_log = (GLchar *)malloc(log_length*sizeof(GLchar));
-      glGetShaderInfoLog(s, log_length, &log_length, error_log);
+      glGetShaderInfoLog(p.shaders[i], log_length, &log_length, error_log);
       printf("Shader <%s> failed to compile: %s\n",
-        shader_prog->filename.c_str(),
+        shader_progs[i].filename.c_str(),
         error_log);
-      
-      // clean up error log (free)
-      int _i;
-      for (_i=0; _i<shaders.size(); i++) {
-        glDeleteShader(shaders[_i]);
-      }
       free(error_log);
-
-      return;
-    } 
-    
-    printf("shader compiled successfully: %s\n",
-      shader_prog->filename.c_str());
-    shaders.push_back(s);
-  } 
-
-  // finally, link all shaders to program
-  GLuint prog = glCreateProgram();
-  for (i=0; i<shaders.size(); i++) {
-    glAttachShader(prog, shaders[i]);
+      compiled = false;
+    } else {
+      printf("shader compiled successfully: %s\n",
+        shader_progs[i].filename.c_str());
+    }
   }
-  glLinkProgram(prog);
 
   // Check for errors
-  glGetProgramiv(prog, GL_LINK_STATUS, (int *)&status);
-  if (!status) {
+  glGetProgramiv(p.prog, GL_LINK_STATUS, &status);
+  if (compiled && !status) {
     GLchar *error_log;
     GLint log_length;
-    glGetProgramiv(prog, GL_INFO_LOG_LENGTH, &log_length);
+    glGetProgramiv(p.prog, GL_INFO_LOG_LENGTH, &log_length);
 
     error_log = (GLchar *)malloc(log_length*sizeof(GLchar));
-    glGetProgramInfoLog(prog, log_length, &log_length, error_log);
+    glGetProgramInfoLog(p.prog, log_length, &log_length, error_log);
     printf("Error linking program: %s\n", error_log);
-
-    // clean up resources
-    glDeleteProgram(prog);
-    int _i;
-    for (_i=0; i<shaders.size(); _i++) {
-      glDeleteShader(shaders[_i]);
-    }
     free(error_log);
-    
+  }
+
+  /* The program keeps what it needs, the shaders can go */
+  for (GLuint s : p.shaders) {
+    glDetachShader(p.prog, s);
+    glDeleteShader(s);
+  }
+  if (!compiled || !status) {
+    glDeleteProgram(p.prog);
     return;
   }
 
-  prog_id = prog;
+#if SHADER_CACHE
+  shader_cache::store(p.cache_key, p.prog);
+#endif
+  prog_id = p.prog;
+}
+
+void prefetch_shaders(const std::vector<ShaderProg> &shader_progs)
+{
+  std::string key = pending_key(shader_progs);
+  if (pending.count(key) == 0) {
+    pending[key] = start_program(shader_progs);
+  }
+}
+
+void discard_prefetched_shaders()
+{
+  for (auto &it : pending) {
+    PendingProgram &p = it.second;
+    for (GLuint s : p.shaders) {
+      glDetachShader(p.prog, s);
+      glDeleteShader(s);
+    }
+    glDeleteProgram(p.prog);
+  }
+  pending.clear();
+}
+
+void bind_shaders(const std::vector<ShaderProg> &shader_progs,
+                  GLuint &prog_id)
+{
+#if RENDER_TRACE
+  std::string names;
+  for (const ShaderProg &p : shader_progs) {
+    names += (names.empty() ? "" : " ") + p.filename;
+  }
+  TRACE_ZONE_DETAIL("bind_shaders", names);
+#endif
+  PendingProgram p;
+  auto it = pending.find(pending_key(shader_progs));
+  if (it != pending.end()) {
+    p = it->second;
+    pending.erase(it);
+  } else {
+    p = start_program(shader_progs);
+  }
+  finish_program(p, shader_progs, prog_id);
 }
 
 GLuint
@@ -337,4 +465,30 @@ load_shaders_simple(std::string nvs, std::string nfs) {
   progs.push_back(fs);
   bind_shaders(progs, prog_id);
   return prog_id;
-}
\ No newline at end of file
+}
+
+void
+prefetch_shaders_simple(std::string nvs, std::string nfs) {
+  std::vector<ShaderProg> progs;
+  progs.push_back({nvs, GL_VERTEX_SHADER});
+  progs.push_back({nfs, GL_FRAGMENT_SHADER});
+  prefetch_shaders(progs);
+}
+
+void
+prefetch_shaders_compute(std::string ncs) {
+  std::vector<ShaderProg> progs;
+  progs.push_back({ncs, GL_COMPUTE_SHADER});
+  prefetch_shaders(progs);
+}
+
+GLuint
+load_shaders_compute(std::string ncs) {
+  GLuint prog_id;
+  std::vector<ShaderProg> progs;
+  ShaderProg cs;
+  cs = {ncs, GL_COMPUTE_SHADER};
+  progs.push_back(cs);
+  bind_shaders(progs, prog_id);
+  return prog_id;
+}
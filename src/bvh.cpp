@@ -0,0 +1,520 @@
+#include <algorithm>
+#include <limits>
+#include <utility>
+#include <cmath>
+#include <glm/glm.hpp>
+
+#include "bvh.hpp"
+
+#define NULL_NODE -1
+#define SAH_BINS 12
+
+static inline float area(const glm::vec3 &lo, const glm::vec3 &hi) {
+  glm::vec3 d = hi - lo;
+  return 2.0f * (d.x*d.y + d.y*d.z + d.z*d.x);
+}
+
+static inline bool contains(const BVH::Node &n,
+                            const glm::vec3 &lo,
+                            const glm::vec3 &hi)
+{
+  return n.lo.x <= lo.x && n.lo.y <= lo.y && n.lo.z <= lo.z
+      && n.hi.x >= hi.x && n.hi.y >= hi.y && n.hi.z >= hi.z;
+}
+
+BVH::BVH(float m)
+  : margin(m)
+  , built_cost(0.0f)
+  , root(NULL_NODE)
+  , free_list(NULL_NODE)
+  , count(0) {}
+
+int BVH::alloc_node() {
+  int id;
+  if (free_list != NULL_NODE) {
+    id = free_list;
+    free_list = nodes[id].parent;
+  } else {
+    id = (int)nodes.size();
+    nodes.push_back(Node());
+  }
+
+  Node &n = nodes[id];
+  n.parent = NULL_NODE;
+  n.child[0] = n.child[1] = NULL_NODE;
+  n.item = -1;
+  return id;
+}
+
+void BVH::free_node(int id) {
+  /* Free nodes are chained through their parent index */
+  nodes[id].parent = free_list;
+  nodes[id].item = -1;
+  free_list = id;
+}
+
+void BVH::fit_ancestors(int id) {
+  while (id != NULL_NODE) {
+    Node &n = nodes[id];
+    const Node &a = nodes[n.child[0]];
+    const Node &b = nodes[n.child[1]];
+    n.lo = glm::min(a.lo, b.lo);
+    n.hi = glm::max(a.hi, b.hi);
+    id = n.parent;
+  }
+}
+
+/*
+ * Descend from the root picking the child whose box grows the least
+ * (in surface area) to hold the new leaf, and stop as soon as making
+ * the leaf a sibling of the current node is cheaper than descending.
+ */
+void BVH::insert_leaf(int leaf) {
+  if (root == NULL_NODE) {
+    root = leaf;
+    nodes[root].parent = NULL_NODE;
+    return;
+  }
+
+  const glm::vec3 lo = nodes[leaf].lo;
+  const glm::vec3 hi = nodes[leaf].hi;
+
+  int sibling = root;
+  while (nodes[sibling].item == -1) {
+    const Node &n = nodes[sibling];
+    float a = area(n.lo, n.hi);
+    float combined = area(glm::min(n.lo, lo), glm::max(n.hi, hi));
+
+    /* Cost of a new parent for (sibling, leaf) here */
+    float cost = 2.0f * combined;
+    /* Every ancestor below this point would grow by the same amount */
+    float inherit = 2.0f * (combined - a);
+
+    float child_cost[2];
+    int i;
+    for (i=0; i<2; i++) {
+      const Node &c = nodes[n.child[i]];
+      float grown = area(glm::min(c.lo, lo), glm::max(c.hi, hi));
+      if (c.item != -1) {
+        child_cost[i] = grown + inherit;
+      } else {
+        child_cost[i] = (grown - area(c.lo, c.hi)) + inherit;
+      }
+    }
+
+    if (cost < child_cost[0] && cost < child_cost[1]) {
+      break;
+    }
+    sibling = child_cost[0] < child_cost[1] ? n.child[0] : n.child[1];
+  }
+
+  int old_parent = nodes[sibling].parent;
+  int parent = alloc_node();
+  nodes[parent].parent = old_parent;
+  nodes[parent].child[0] = sibling;
+  nodes[parent].child[1] = leaf;
+  nodes[sibling].parent = parent;
+  nodes[leaf].parent = parent;
+
+  if (old_parent == NULL_NODE) {
+    root = parent;
+  } else {
+    Node &op = nodes[old_parent];
+    op.child[op.child[0] == sibling ? 0 : 1] = parent;
+  }
+
+  fit_ancestors(parent);
+}
+
+void BVH::remove_leaf(int leaf) {
+  if (leaf == root) {
+    root = NULL_NODE;
+    return;
+  }
+
+  int parent = nodes[leaf].parent;
+  int grand = nodes[parent].parent;
+  int sibling = nodes[parent].child[nodes[parent].child[0] == leaf ? 1 : 0];
+
+  if (grand == NULL_NODE) {
+    root = sibling;
+    nodes[sibling].parent = NULL_NODE;
+  } else {
+    Node &g = nodes[grand];
+    g.child[g.child[0] == parent ? 0 : 1] = sibling;
+    nodes[sibling].parent = grand;
+    fit_ancestors(grand);
+  }
+  free_node(parent);
+}
+
+void BVH::insert(int item, const glm::vec3 &c, const glm::vec3 &e) {
+  if (item >= (int)leaves.size()) {
+    leaves.resize(item+1, NULL_NODE);
+  }
+
+  int leaf = alloc_node();
+  glm::vec3 fat = e + glm::vec3(margin);
+  nodes[leaf].lo = c - fat;
+  nodes[leaf].hi = c + fat;
+  nodes[leaf].item = item;
+  leaves[item] = leaf;
+  count++;
+
+  insert_leaf(leaf);
+}
+
+void BVH::remove(int item) {
+  int leaf = leaves[item];
+  remove_leaf(leaf);
+  free_node(leaf);
+  leaves[item] = NULL_NODE;
+  count--;
+}
+
+bool BVH::update(int item, const glm::vec3 &c, const glm::vec3 &e) {
+  int leaf = leaves[item];
+  if (contains(nodes[leaf], c - e, c + e)) {
+    return false;
+  }
+
+  remove_leaf(leaf);
+  glm::vec3 fat = e + glm::vec3(margin);
+  nodes[leaf].lo = c - fat;
+  nodes[leaf].hi = c + fat;
+  insert_leaf(leaf);
+  return true;
+}
+
+void BVH::refit(int item, const glm::vec3 &c, const glm::vec3 &e) {
+  int leaf = leaves[item];
+  glm::vec3 fat = e + glm::vec3(margin);
+  nodes[leaf].lo = c - fat;
+  nodes[leaf].hi = c + fat;
+  fit_ancestors(nodes[leaf].parent);
+}
+
+float BVH::sah_cost() const {
+  if (root == NULL_NODE) {
+    return 0.0f;
+  }
+
+  float root_area = area(nodes[root].lo, nodes[root].hi);
+  if (root_area <= 0.0f) {
+    return 0.0f;
+  }
+
+  float cost = 0.0f;
+  std::vector<int> stack(1, root);
+  while (!stack.empty()) {
+    int id = stack.back();
+    stack.pop_back();
+
+    const Node &n = nodes[id];
+    if (n.item != -1) {
+      continue;
+    }
+    cost += area(n.lo, n.hi);
+    stack.push_back(n.child[0]);
+    stack.push_back(n.child[1]);
+  }
+  return cost / root_area;
+}
+
+void BVH::build(const cull::Bounds &b) {
+  nodes.clear();
+  leaves.assign(b.size(), NULL_NODE);
+  root = NULL_NODE;
+  free_list = NULL_NODE;
+  count = 0;
+
+  /* Create the leaves directly, rebuild() makes the hierarchy */
+  size_t i;
+  for (i=0; i<b.size(); i++) {
+    glm::vec3 c(b.cx[i], b.cy[i], b.cz[i]);
+    glm::vec3 e(b.ex[i], b.ey[i], b.ez[i]);
+    glm::vec3 fat = e + glm::vec3(margin);
+
+    int leaf = alloc_node();
+    nodes[leaf].lo = c - fat;
+    nodes[leaf].hi = c + fat;
+    nodes[leaf].item = (int)i;
+    leaves[i] = leaf;
+    count++;
+  }
+
+  rebuild();
+}
+
+/*
+ * Top-down rebuild over the existing leaves. Internal nodes are all
+ * thrown away and recreated by recursively splitting the leaves with
+ * a binned surface area heuristic on their centroids.
+ */
+void BVH::rebuild() {
+  std::vector<int> ids;
+  ids.reserve(count);
+
+  size_t i;
+  for (i=0; i<leaves.size(); i++) {
+    if (leaves[i] != NULL_NODE) {
+      ids.push_back(leaves[i]);
+    }
+  }
+
+  /* Return every internal node to the free list */
+  free_list = NULL_NODE;
+  for (i=0; i<nodes.size(); i++) {
+    if (nodes[i].item == -1) {
+      free_node((int)i);
+    }
+  }
+
+  root = ids.empty() ? NULL_NODE : build_range(ids.data(), (int)ids.size(), NULL_NODE);
+  built_cost = sah_cost();
+}
+
+int BVH::build_range(int *ids, int n, int parent) {
+  if (n == 1) {
+    nodes[ids[0]].parent = parent;
+    return ids[0];
+  }
+
+  /* Bounds of the centroids decide the split axis */
+  glm::vec3 clo(std::numeric_limits<float>::max());
+  glm::vec3 chi(-std::numeric_limits<float>::max());
+  int i;
+  for (i=0; i<n; i++) {
+    glm::vec3 c = 0.5f * (nodes[ids[i]].lo + nodes[ids[i]].hi);
+    clo = glm::min(clo, c);
+    chi = glm::max(chi, c);
+  }
+
+  glm::vec3 d = chi - clo;
+  int axis = 0;
+  if (d.y > d[axis]) axis = 1;
+  if (d.z > d[axis]) axis = 2;
+
+  int mid = n / 2;
+  if (d[axis] > 0.0f) {
+    struct { glm::vec3 lo, hi; int n; } bins[SAH_BINS];
+    int b;
+    for (b=0; b<SAH_BINS; b++) {
+      bins[b].lo = glm::vec3(std::numeric_limits<float>::max());
+      bins[b].hi = glm::vec3(-std::numeric_limits<float>::max());
+      bins[b].n = 0;
+    }
+
+    float scale = SAH_BINS / d[axis];
+    auto bin_of = [&](int id) -> int {
+      float c = 0.5f * (nodes[id].lo[axis] + nodes[id].hi[axis]);
+      int k = (int)((c - clo[axis]) * scale);
+      return std::min(std::max(k, 0), SAH_BINS-1);
+    };
+
+    for (i=0; i<n; i++) {
+      int k = bin_of(ids[i]);
+      bins[k].lo = glm::min(bins[k].lo, nodes[ids[i]].lo);
+      bins[k].hi = glm::max(bins[k].hi, nodes[ids[i]].hi);
+      bins[k].n++;
+    }
+
+    /* Sweep from the right to get the cost of every right half */
+    float right_cost[SAH_BINS];
+    glm::vec3 lo = bins[SAH_BINS-1].lo, hi = bins[SAH_BINS-1].hi;
+    int cnt = 0;
+    for (b=SAH_BINS-1; b>0; b--) {
+      lo = glm::min(lo, bins[b].lo);
+      hi = glm::max(hi, bins[b].hi);
+      cnt += bins[b].n;
+      right_cost[b] = cnt ? cnt * area(lo, hi) : 0.0f;
+    }
+
+    float best = std::numeric_limits<float>::max();
+    int best_split = -1;
+    lo = bins[0].lo; hi = bins[0].hi;
+    cnt = 0;
+    for (b=0; b<SAH_BINS-1; b++) {
+      lo = glm::min(lo, bins[b].lo);
+      hi = glm::max(hi, bins[b].hi);
+      cnt += bins[b].n;
+      if (cnt == 0 || cnt == n) {
+        continue;
+      }
+      float cost = cnt * area(lo, hi) + right_cost[b+1];
+      if (cost < best) {
+        best = cost;
+        best_split = b;
+      }
+    }
+
+    if (best_split != -1) {
+      int *p = std::partition(ids, ids + n, [&](int id) {
+        return bin_of(id) <= best_split;
+      });
+      mid = (int)(p - ids);
+    }
+  }
+
+  if (mid == 0 || mid == n) {
+    mid = n / 2;
+  }
+
+  int id = alloc_node();
+  nodes[id].parent = parent;
+  int left = build_range(ids, mid, id);
+  int right = build_range(ids + mid, n - mid, id);
+  nodes[id].child[0] = left;
+  nodes[id].child[1] = right;
+  nodes[id].lo = glm::min(nodes[left].lo, nodes[right].lo);
+  nodes[id].hi = glm::max(nodes[left].hi, nodes[right].hi);
+  return id;
+}
+
+void BVH::collect(int id, std::vector<int> &out) const {
+  std::vector<int> stack(1, id);
+  while (!stack.empty()) {
+    const Node &n = nodes[stack.back()];
+    stack.pop_back();
+    if (n.item != -1) {
+      out.push_back(n.item);
+    } else {
+      stack.push_back(n.child[0]);
+      stack.push_back(n.child[1]);
+    }
+  }
+}
+
+/*
+ * A node fully inside a plane stays inside for its whole subtree,
+ * so each stack entry carries the mask of planes still to be tested.
+ * Once the mask is empty the subtree is accepted without tests.
+ */
+void BVH::query_frustum(const cull::Frustum &f, std::vector<int> &out) const {
+  out.clear();
+  if (root == NULL_NODE) {
+    return;
+  }
+
+  std::vector<std::pair<int, int> > stack;
+  stack.push_back(std::make_pair(root, 0x3f));
+  while (!stack.empty()) {
+    int id = stack.back().first;
+    int mask = stack.back().second;
+    stack.pop_back();
+
+    const Node &n = nodes[id];
+    glm::vec3 c = 0.5f * (n.lo + n.hi);
+    glm::vec3 e = 0.5f * (n.hi - n.lo);
+
+    bool outside = false;
+    int k;
+    for (k=0; k<6; k++) {
+      if (!(mask & (1 << k))) {
+        continue;
+      }
+      const glm::vec4 &p = f.planes[k];
+      float dist = p.x*c.x + p.y*c.y + p.z*c.z + p.w;
+      float r = fabsf(p.x)*e.x + fabsf(p.y)*e.y + fabsf(p.z)*e.z;
+      if (dist + r < 0) {
+        outside = true;
+        break;
+      }
+      if (dist - r >= 0) {
+        mask &= ~(1 << k);
+      }
+    }
+
+    if (outside) {
+      continue;
+    }
+    if (mask == 0 || n.item != -1) {
+      collect(id, out);
+      continue;
+    }
+    stack.push_back(std::make_pair(n.child[0], mask));
+    stack.push_back(std::make_pair(n.child[1], mask));
+  }
+}
+
+void BVH::query_aabb(const glm::vec3 &lo,
+                     const glm::vec3 &hi,
+                     std::vector<int> &out) const
+{
+  out.clear();
+  if (root == NULL_NODE) {
+    return;
+  }
+
+  std::vector<int> stack(1, root);
+  while (!stack.empty()) {
+    const Node &n = nodes[stack.back()];
+    stack.pop_back();
+
+    if (n.hi.x < lo.x || n.lo.x > hi.x ||
+        n.hi.y < lo.y || n.lo.y > hi.y ||
+        n.hi.z < lo.z || n.lo.z > hi.z) {
+      continue;
+    }
+    if (n.item != -1) {
+      out.push_back(n.item);
+    } else {
+      stack.push_back(n.child[0]);
+      stack.push_back(n.child[1]);
+    }
+  }
+}
+
+/* Slab test, returns the entry distance or -1 on a miss */
+static inline float ray_box(const glm::vec3 &o,
+                            const glm::vec3 &inv,
+                            float tmax,
+                            const glm::vec3 &lo,
+                            const glm::vec3 &hi)
+{
+  float t0 = 0.0f, t1 = tmax;
+  int i;
+  for (i=0; i<3; i++) {
+    float a = (lo[i] - o[i]) * inv[i];
+    float b = (hi[i] - o[i]) * inv[i];
+    /* fmin/fmax drop the NaN from 0*inf when the ray is in a slab plane */
+    t0 = fmaxf(t0, fminf(a, b));
+    t1 = fminf(t1, fmaxf(a, b));
+  }
+  return t0 <= t1 ? t0 : -1.0f;
+}
+
+void BVH::query_ray(const glm::vec3 &o,
+                    const glm::vec3 &dir,
+                    float tmax,
+                    std::vector<int> &out) const
+{
+  out.clear();
+  if (root == NULL_NODE) {
+    return;
+  }
+
+  glm::vec3 inv(1.0f/dir.x, 1.0f/dir.y, 1.0f/dir.z);
+  std::vector<std::pair<float, int> > hits;
+  std::vector<int> stack(1, root);
+  while (!stack.empty()) {
+    const Node &n = nodes[stack.back()];
+    stack.pop_back();
+
+    float t = ray_box(o, inv, tmax, n.lo, n.hi);
+    if (t < 0.0f) {
+      continue;
+    }
+    if (n.item != -1) {
+      hits.push_back(std::make_pair(t, n.item));
+    } else {
+      stack.push_back(n.child[0]);
+      stack.push_back(n.child[1]);
+    }
+  }
+
+  std::sort(hits.begin(), hits.end());
+  for (const std::pair<float, int> &h : hits) {
+    out.push_back(h.second);
+  }
+}
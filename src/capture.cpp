@@ -0,0 +1,217 @@
+#include <stdio.h>
+#include <signal.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <nlohmann/json.hpp>
+#include <glad/glad.h>
+
+#include "capture.hpp"
+#include "types.hpp"
+#include "helpers.h"
+#include "trace.hpp"
+
+#define READBACK_SLOTS 3
+#define PIPE_BUFFERS 4 /* Raw frames queued for the pipe */
+#define PROGRESS_FRAMES 100 /* Report progress this often */
+using json = nlohmann::json;
+
+static glm::vec3 catmull_rom(const glm::vec3 &p0,
+                             const glm::vec3 &p1,
+                             const glm::vec3 &p2,
+                             const glm::vec3 &p3,
+                             float u) {
+  float u2 = u * u;
+  float u3 = u2 * u;
+  return 0.5f * ((2.0f * p1) +
+                 (p2 - p0) * u +
+                 (2.0f * p0 - 5.0f * p1 + 4.0f * p2 - p3) * u2 +
+                 (3.0f * p1 - p0 - 3.0f * p2 + p3) * u3);
+}
+
+/*
+ * Normalized lerp, good enough between nearby keys. Opposite
+ * directions have no midpoint; hold "a" for the first half then.
+ */
+static glm::vec3 nlerp(const glm::vec3 &a, const glm::vec3 &b, float u) {
+  glm::vec3 v = a + (b - a) * u;
+  float len = glm::length(v);
+  if (len < 1e-4f) {
+    return u < 0.5f ? a : b;
+  }
+  return v / len;
+}
+
+bool capture::load_path(const std::string &filepath,
+                        const Orientation &base,
+                        std::vector<Key> &keys) {
+  TRACE_ZONE_DETAIL("load_path", filepath);
+  std::ifstream ifs(filepath);
+  if (!ifs.is_open()) {
+    printf("Failed to open file: %s\n", filepath.c_str());
+    return false;
+  }
+
+  std::stringstream buf;
+  buf << ifs.rdbuf();
+
+  /* parse() and get() throw on malformed input */
+  try {
+    json j = json::parse(buf.str());
+    if (!j.is_array() || j.size() == 0) {
+      printf("Camera path must be a non-empty JSON array\n");
+      return false;
+    }
+
+    keys.clear();
+    for (auto &k : j) {
+      Key key;
+      key.t = k.contains("t") ? k["t"].get<float>() : 0.0f;
+      key.eye = k.contains("eye") ?
+        parse_vec3(k["eye"].get<std::string>()) : base.eye;
+      key.top = k.contains("top") ?
+        parse_vec3(k["top"].get<std::string>()) : base.top;
+      key.fovy = k.contains("fovy") ? k["fovy"].get<float>() : base.fovy;
+      if (k.contains("target")) {
+        key.gaze = parse_vec3(k["target"].get<std::string>()) - key.eye;
+      } else if (k.contains("gaze")) {
+        key.gaze = parse_vec3(k["gaze"].get<std::string>());
+      } else {
+        key.gaze = base.gaze;
+      }
+      key.gaze = glm::normalize(key.gaze);
+      key.top = glm::normalize(key.top);
+
+      if (!keys.empty() && key.t <= keys.back().t) {
+        printf("Camera path times must increase (t = %g)\n", key.t);
+        return false;
+      }
+      keys.push_back(key);
+    }
+  } catch (const json::exception &e) {
+    printf("Malformed camera path: %s\n", e.what());
+    return false;
+  }
+  return true;
+}
+
+Orientation capture::sample(const std::vector<Key> &keys,
+                            const Orientation &base,
+                            float t) {
+  Orientation o = base;
+  int n = (int)keys.size();
+
+  /* Segment i runs from keys[i] to keys[i+1] */
+  int i = 0;
+  while (i < n-2 && t >= keys[i+1].t) {
+    i++;
+  }
+  const Key &a = keys[i];
+  const Key &b = keys[std::min(i+1, n-1)];
+
+  float u = 0.0f;
+  if (b.t > a.t) {
+    u = std::max(0.0f, std::min((t - a.t) / (b.t - a.t), 1.0f));
+  }
+
+  /* Phantom end points repeat the first and last keys */
+  const Key &prev = keys[std::max(i-1, 0)];
+  const Key &next = keys[std::min(i+2, n-1)];
+  o.eye = catmull_rom(prev.eye, a.eye, b.eye, next.eye, u);
+  o.gaze = nlerp(a.gaze, b.gaze, u);
+  o.top = nlerp(a.top, b.top, u);
+  o.fovy = a.fovy + (b.fovy - a.fovy) * u;
+  return o;
+}
+
+void capture::record(Scene &scene,
+                     Renderer &renderer,
+                     const std::vector<Key> &keys,
+                     float fps,
+                     const std::string &pattern,
+                     const std::string &pipe_cmd) {
+  int width = renderer.width;
+  int height = renderer.height;
+  size_t size = 3 * (size_t)width * height;
+
+  float duration = keys.back().t - keys.front().t;
+  int frames = (int)floorf(duration * fps) + 1;
+
+  /*
+   * Raw frames go to the pipe from a single writer thread, so they
+   * arrive in order; images use the screen:: writer's threads.
+   */
+  FILE *pipe = NULL;
+  ImageWriter *pipe_writer = NULL;
+  if (!pipe_cmd.empty()) {
+    /* A dying encoder should fail writes, not kill the renderer */
+    signal(SIGPIPE, SIG_IGN);
+    pipe = popen(pipe_cmd.c_str(), "w");
+    if (pipe == NULL) {
+      printf("Failed to start: %s\n", pipe_cmd.c_str());
+      return;
+    }
+    pipe_writer = new ImageWriter(1, PIPE_BUFFERS);
+  }
+
+  Readback readback(READBACK_SLOTS);
+  char path[1024];
+
+  printf("Capturing %d frames (%.2f s at %g fps)\n", frames, duration, fps);
+  auto start = std::chrono::steady_clock::now();
+  int f;
+  for (f=0; f<frames; f++) {
+    TRACE_ZONE("capture frame");
+    float t = keys.front().t + (float)f / fps;
+    *scene.orient = capture::sample(keys, *scene.orient, t);
+
+    renderer.timer.frame();
+    renderer.update(scene);
+    renderer.render(scene);
+
+    if (pipe_writer != NULL) {
+      readback.read_pixels(renderer.target->fbo,
+                           GL_COLOR_ATTACHMENT0,
+                           width, height,
+                           GL_BGR, GL_UNSIGNED_BYTE, size,
+        [=](const unsigned char *data, size_t n) {
+          ImageWriter::Buffer *buf = pipe_writer->acquire(n);
+          memcpy(buf->data(), data, n);
+          pipe_writer->submit(buf, pipe);
+        });
+    } else {
+      snprintf(path, sizeof(path), pattern.c_str(), f);
+      screen::color_2D_screenshot(readback,
+                                  renderer.target->fbo,
+                                  GL_COLOR_ATTACHMENT0,
+                                  width, height,
+                                  path);
+    }
+    readback.poll();
+
+    if ((f+1) % PROGRESS_FRAMES == 0) {
+      printf("Captured %d/%d frames\n", f+1, frames);
+    }
+  }
+  readback.flush();
+
+  size_t writer_stalls;
+  if (pipe_writer != NULL) {
+    pipe_writer->wait();
+    writer_stalls = pipe_writer->stalls;
+    delete pipe_writer;
+    pclose(pipe);
+  } else {
+    screen::finish();
+    writer_stalls = screen::writer().stalls;
+  }
+
+  double s = std::chrono::duration<double>(
+    std::chrono::steady_clock::now() - start).count();
+  printf("Captured %d frames in %.2f s (%.1f fps), "
+         "readback stalls %zu, writer stalls %zu\n",
+    frames, s, frames / s, readback.stalls, writer_stalls);
+}
@@ -0,0 +1,159 @@
+#include <glm/glm.hpp>
+#include <glm/mat4x4.hpp>
+#include <cmath>
+
+#if defined(__SSE2__)
+  #include <emmintrin.h>
+  #define CULL_SSE 1
+#else
+  #define CULL_SSE 0
+#endif
+
+#include "cull.hpp"
+
+void cull::Bounds::resize(size_t n) {
+  cx.resize(n); cy.resize(n); cz.resize(n);
+  ex.resize(n); ey.resize(n); ez.resize(n);
+}
+
+void cull::Bounds::set(size_t i, const glm::vec3 &c, const glm::vec3 &e) {
+  cx[i] = c.x; cy[i] = c.y; cz[i] = c.z;
+  ex[i] = e.x; ey[i] = e.y; ez[i] = e.z;
+}
+
+/*
+ * Gribb & Hartmann: for clip coordinates c = M*p, the point p
+ * is inside the frustum iff -c.w <= c.{x,y,z} <= c.w. Each of
+ * these 6 inequalities is a plane in world coordinates made
+ * from the rows of M (glm is column-major, so row i is
+ * (M[0][i], M[1][i], M[2][i], M[3][i])).
+ */
+cull::Frustum cull::frustum(const glm::mat4 &M) {
+  glm::vec4 row[4];
+  int i;
+  for (i=0; i<4; i++) {
+    row[i] = glm::vec4(M[0][i], M[1][i], M[2][i], M[3][i]);
+  }
+
+  Frustum f;
+  f.planes[0] = row[3] + row[0]; /* left */
+  f.planes[1] = row[3] - row[0]; /* right */
+  f.planes[2] = row[3] + row[1]; /* bottom */
+  f.planes[3] = row[3] - row[1]; /* top */
+  f.planes[4] = row[3] + row[2]; /* near */
+  f.planes[5] = row[3] - row[2]; /* far */
+
+  for (i=0; i<6; i++) {
+    glm::vec4 &p = f.planes[i];
+    float len = sqrtf(p.x*p.x + p.y*p.y + p.z*p.z);
+    p = p / len;
+  }
+  return f;
+}
+
+void cull::transform_aabb(const glm::mat4 &M,
+                          const glm::vec3 &lo,
+                          const glm::vec3 &hi,
+                          glm::vec3 &center,
+                          glm::vec3 &extent)
+{
+  /*
+   * Arvo: the extent of the transformed box along world axis i
+   * is the sum of the absolute values of row i of the linear
+   * part of M, weighted by the local extents.
+   */
+  glm::vec3 c = 0.5f * (lo + hi);
+  glm::vec3 e = 0.5f * (hi - lo);
+
+  glm::vec4 _c = M * glm::vec4(c, 1.0f);
+  center = glm::vec3(_c.x, _c.y, _c.z);
+
+  int i;
+  for (i=0; i<3; i++) {
+    extent[i] = fabsf(M[0][i]) * e.x
+              + fabsf(M[1][i]) * e.y
+              + fabsf(M[2][i]) * e.z;
+  }
+}
+
+bool cull::aabb_in_frustum(const Frustum &f,
+                           const glm::vec3 &c,
+                           const glm::vec3 &e)
+{
+  int i;
+  for (i=0; i<6; i++) {
+    const glm::vec4 &p = f.planes[i];
+    float d = p.x*c.x + p.y*c.y + p.z*c.z + p.w;
+    float r = fabsf(p.x)*e.x + fabsf(p.y)*e.y + fabsf(p.z)*e.z;
+    if (d + r < 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void cull::frustum_cull(const Bounds &b,
+                        const Frustum &f,
+                        std::vector<int> &visible)
+{
+  visible.clear();
+  size_t n = b.size();
+  size_t i = 0;
+
+#if CULL_SSE
+  /*
+   * Test 4 boxes against each plane per iteration. A box is
+   * rejected as soon as it is fully behind any one plane, so
+   * the running mask is the AND over all 6 planes.
+   */
+  __m128 pn[6][3], pd[6], pa[6][3];
+  int k;
+  for (k=0; k<6; k++) {
+    const glm::vec4 &p = f.planes[k];
+    pn[k][0] = _mm_set1_ps(p.x);
+    pn[k][1] = _mm_set1_ps(p.y);
+    pn[k][2] = _mm_set1_ps(p.z);
+    pd[k] = _mm_set1_ps(p.w);
+    pa[k][0] = _mm_set1_ps(fabsf(p.x));
+    pa[k][1] = _mm_set1_ps(fabsf(p.y));
+    pa[k][2] = _mm_set1_ps(fabsf(p.z));
+  }
+
+  const __m128 zero = _mm_setzero_ps();
+  for (; i+4<=n; i+=4) {
+    __m128 cx = _mm_loadu_ps(&b.cx[i]);
+    __m128 cy = _mm_loadu_ps(&b.cy[i]);
+    __m128 cz = _mm_loadu_ps(&b.cz[i]);
+    __m128 ex = _mm_loadu_ps(&b.ex[i]);
+    __m128 ey = _mm_loadu_ps(&b.ey[i]);
+    __m128 ez = _mm_loadu_ps(&b.ez[i]);
+
+    __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+    for (k=0; k<6; k++) {
+      __m128 d = _mm_add_ps(
+        _mm_add_ps(_mm_mul_ps(pn[k][0], cx), _mm_mul_ps(pn[k][1], cy)),
+        _mm_add_ps(_mm_mul_ps(pn[k][2], cz), pd[k]));
+      __m128 r = _mm_add_ps(
+        _mm_add_ps(_mm_mul_ps(pa[k][0], ex), _mm_mul_ps(pa[k][1], ey)),
+        _mm_mul_ps(pa[k][2], ez));
+      inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(d, r), zero));
+    }
+
+    int mask = _mm_movemask_ps(inside);
+    while (mask) {
+      int bit = __builtin_ctz(mask);
+      visible.push_back((int)(i + bit));
+      mask &= mask - 1;
+    }
+  }
+#endif
+
+  /* Remainder (or everything, without SSE) */
+  for (; i<n; i++) {
+    glm::vec3 c(b.cx[i], b.cy[i], b.cz[i]);
+    glm::vec3 e(b.ex[i], b.ey[i], b.ez[i]);
+    if (aabb_in_frustum(f, c, e)) {
+      visible.push_back((int)i);
+    }
+  }
+}
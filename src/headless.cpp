@@ -0,0 +1,126 @@
+#include <stdio.h>
+#include <string.h>
+#include <glad/glad.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include "headless.hpp"
+
+namespace {
+  EGLDisplay display = EGL_NO_DISPLAY;
+  EGLSurface surface = EGL_NO_SURFACE;
+  EGLContext context = EGL_NO_CONTEXT;
+
+  bool has_extension(const char *list, const char *name) {
+    return list != NULL && strstr(list, name) != NULL;
+  }
+
+  EGLDisplay surfaceless_display() {
+    const char *ext = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    if (!has_extension(ext, "EGL_MESA_platform_surfaceless")) {
+      return EGL_NO_DISPLAY;
+    }
+
+    PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display = 
+      (PFNEGLGETPLATFORMDISPLAYEXTPROC)
+        eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (get_platform_display == NULL) {
+      return EGL_NO_DISPLAY;
+    }
+    return get_platform_display(EGL_PLATFORM_SURFACELESS_MESA,
+                                EGL_DEFAULT_DISPLAY,
+                                NULL);
+  }
+}
+
+bool headless::init() {
+  bool surfaceless = true;
+  display = surfaceless_display();
+  if (display == EGL_NO_DISPLAY) {
+    surfaceless = false;
+    display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+  }
+
+  EGLint major, minor;
+  if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor)) {
+    printf("Failed to initialize EGL\n");
+    return false;
+  }
+  printf("EGL %d.%d (%s)\n", major, minor, 
+    surfaceless ? "surfaceless" : "pbuffer");
+
+  const EGLint config_attribs[] = {
+    EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+    EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+    EGL_RED_SIZE, 8,
+    EGL_GREEN_SIZE, 8,
+    EGL_BLUE_SIZE, 8,
+    EGL_DEPTH_SIZE, 24,
+    EGL_NONE
+  };
+  EGLConfig config = NULL;
+  EGLint num_configs = 0;
+  eglChooseConfig(display, config_attribs, &config, 1, &num_configs);
+
+  /* Surfaceless contexts do not need a config at all */
+  const char *ext = eglQueryString(display, EGL_EXTENSIONS);
+  if (num_configs == 0 && 
+      !has_extension(ext, "EGL_KHR_no_config_context")) {
+    printf("No EGL config for an OpenGL pbuffer\n");
+    return false;
+  }
+
+  eglBindAPI(EGL_OPENGL_API);
+
+  /* 4.3 for compute shaders and shader storage buffers */
+  const EGLint context_attribs[] = {
+    EGL_CONTEXT_MAJOR_VERSION, 4,
+    EGL_CONTEXT_MINOR_VERSION, 3,
+    EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+    EGL_NONE
+  };
+  context = eglCreateContext(display, 
+                             num_configs > 0 ? config : EGL_NO_CONFIG_KHR,
+                             EGL_NO_CONTEXT, 
+                             context_attribs);
+  if (context == EGL_NO_CONTEXT) {
+    printf("Failed to create an OpenGL 4.3 core context\n");
+    return false;
+  }
+
+  if (!surfaceless && num_configs > 0) {
+    const EGLint pbuffer_attribs[] = {
+      EGL_WIDTH, 1,
+      EGL_HEIGHT, 1,
+      EGL_NONE
+    };
+    surface = eglCreatePbufferSurface(display, config, pbuffer_attribs);
+  }
+
+  if (!eglMakeCurrent(display, surface, surface, context)) {
+    printf("Failed to make the EGL context current\n");
+    return false;
+  }
+
+  if (!gladLoadGLLoader((GLADloadproc)eglGetProcAddress)) {
+    printf("FAILED TO LOAD GLAD!\n"); 
+    return false;
+  }
+  printf("Renderer: %s\n", glGetString(GL_RENDERER));
+  return true;
+}
+
+void headless::terminate() {
+  if (display == EGL_NO_DISPLAY) {
+    return;
+  }
+  eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+  if (surface != EGL_NO_SURFACE) {
+    eglDestroySurface(display, surface);
+  }
+  if (context != EGL_NO_CONTEXT) {
+    eglDestroyContext(display, context);
+  }
+  eglTerminate(display);
+  display = EGL_NO_DISPLAY;
+}
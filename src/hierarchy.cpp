@@ -0,0 +1,65 @@
+#include <assert.h>
+#include <string.h>
+#include <algorithm>
+#include <glm/glm.hpp>
+#include <glm/mat4x4.hpp>
+
+#include "mat.hpp"
+#include "hierarchy.hpp"
+
+Hierarchy::Hierarchy()
+  : first_dirty(0) 
+{
+}
+
+int Hierarchy::add(int parent, const glm::mat4 &local) {
+  int id = (int)parent_.size();
+  assert(parent < id);
+
+  parent_.push_back(parent);
+  local_.push_back(local);
+  world_.push_back(local);
+  dirty_.push_back(1);
+  updated_.push_back(0);
+  first_dirty = std::min(first_dirty, (size_t)id);
+  return id;
+}
+
+void Hierarchy::set_local(int node, const glm::mat4 &local) {
+  local_[node] = local;
+  dirty_[node] = 1;
+  first_dirty = std::min(first_dirty, (size_t)node);
+}
+
+void Hierarchy::update() {
+  size_t n = parent_.size();
+  memset(updated_.data(), 0, n);
+  if (first_dirty >= n) {
+    return;
+  }
+
+  const int *parent = parent_.data();
+  uint8_t *dirty = dirty_.data();
+  uint8_t *updated = updated_.data();
+
+  size_t i;
+  for (i=first_dirty; i<n; i++) {
+    int p = parent[i];
+    /* Parents come first, so their flag is already final */
+    if (p >= 0) {
+      dirty[i] |= updated[p];
+    }
+    if (!dirty[i]) {
+      continue;
+    }
+
+    if (p < 0) {
+      world_[i] = local_[i];
+    } else {
+      mat::mul(world_[p], local_[i], world_[i]);
+    }
+    dirty[i] = 0;
+    updated[i] = 1;
+  }
+  first_dirty = n;
+}
@@ -7,6 +7,7 @@
 #include <list>
 #include "lib.hpp"
 #include "helpers.h"
+#include "trace.hpp"
 
 #define SPACE_CHAR " "
 #define SLASH_CHAR "/"
@@ -166,6 +167,7 @@ static ld_o::VP* handle_vp(std::list<std::string> &chks) {
 }
 
 void load_obj(std::string filepath, std::vector<ld_o::VBO_STRUCT> &data) {
+  TRACE_ZONE_DETAIL("load_obj", filepath);
   printf("Loading %s\n", filepath.c_str());
   std::ifstream infile(filepath);
   if (!infile.is_open()) {
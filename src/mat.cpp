@@ -8,6 +8,12 @@
 #include <iostream>
 #include <cmath>
 
+#if defined(__AVX__)
+  #include <immintrin.h>
+#elif defined(__SSE__)
+  #include <xmmintrin.h>
+#endif
+
 #include "helpers.h"
 #include "mat.hpp"
 #include "lib.hpp"
@@ -101,7 +107,7 @@ glm::mat4 mat::view(const glm::vec3 &g,
 
   // M_cam = [ u v w e ]^-1, where u, v, w are
   // vec4 with the 4th index set to 0.
-  glm::mat4 M_cam = glm::inverse(glm::mat4(
+  glm::mat4 M_cam = mat::rigid_inverse(glm::mat4(
     glm::vec4(u,0),
     glm::vec4(v,0),
     glm::vec4(w,0),
@@ -120,43 +126,157 @@ glm::mat4 mat::view(const glm::vec3 &g,
 glm::mat3 mat::rot(const float &theta,
                    const glm::vec3 &a)
 {
-  // determine rotational basis
-  glm::vec3 w, u, v;
-  w = glm::normalize(a);
-
   /*
-   * (1) Construct an arbitrary vector t which is not colinear
-   *     with w.
-   * (2) Find u by taking the cross product of t and w. This
-   *     works since t and w are not colinear (i.e. not on the
-   *     same line), their cross product would form a vector
-   *     which is perpendicular to w.
+   * q = (w, x, y, z) = (cos(theta/2), sin(theta/2) * a/|a|).
+   * The matrix of v -> q v q* written out, no basis or products.
    */
-  glm::vec3 t = w;
-  int minInd = 0;
-  {
-    GLfloat min = (GLfloat)std::numeric_limits<float>::max();
-    int i;
-    for (i=0; i<3; i++) {
-      if (w[i] < min) {
-        minInd = i;
-        min = w[i];
+  glm::vec3 n = glm::normalize(a);
+  float h = 0.5f * theta;
+  float s = sinf(h);
+  float w = cosf(h);
+  float x = s*n.x, y = s*n.y, z = s*n.z;
+
+  float xx = x*x, yy = y*y, zz = z*z;
+  float xy = x*y, xz = x*z, yz = y*z;
+  float wx = w*x, wy = w*y, wz = w*z;
+
+  /* Column major */
+  return glm::mat3(
+    1.0f - 2.0f*(yy+zz), 2.0f*(xy+wz), 2.0f*(xz-wy),
+    2.0f*(xy-wz), 1.0f - 2.0f*(xx+zz), 2.0f*(yz+wx),
+    2.0f*(xz+wy), 2.0f*(yz-wx), 1.0f - 2.0f*(xx+yy)
+  );
+}
+
+glm::mat4 mat::rigid_inverse(const glm::mat4 &M) {
+  glm::mat4 inv;
+#if defined(__SSE__)
+  __m128 c0 = _mm_loadu_ps(&M[0][0]);
+  __m128 c1 = _mm_loadu_ps(&M[1][0]);
+  __m128 c2 = _mm_loadu_ps(&M[2][0]);
+  __m128 c3 = _mm_setzero_ps();
+  __m128 t = _mm_loadu_ps(&M[3][0]);
+
+  /* Columns of R^T are the rows of R; the w lanes end up 0 */
+  _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+
+  __m128 r;
+  r = _mm_mul_ps(c0, _mm_shuffle_ps(t, t, _MM_SHUFFLE(0,0,0,0)));
+  r = _mm_add_ps(r, _mm_mul_ps(c1, _mm_shuffle_ps(t, t, _MM_SHUFFLE(1,1,1,1))));
+  r = _mm_add_ps(r, _mm_mul_ps(c2, _mm_shuffle_ps(t, t, _MM_SHUFFLE(2,2,2,2))));
+  r = _mm_sub_ps(_mm_setr_ps(0.0f, 0.0f, 0.0f, 1.0f), r);
+
+  _mm_storeu_ps(&inv[0][0], c0);
+  _mm_storeu_ps(&inv[1][0], c1);
+  _mm_storeu_ps(&inv[2][0], c2);
+  _mm_storeu_ps(&inv[3][0], r);
+#else
+  int i, j;
+  for (i=0; i<3; i++) {
+    for (j=0; j<3; j++) {
+      inv[i][j] = M[j][i];
+    }
+    inv[i][3] = 0.0f;
+  }
+  for (j=0; j<3; j++) {
+    inv[3][j] = -(M[j][0]*M[3][0] + M[j][1]*M[3][1] + M[j][2]*M[3][2]);
+  }
+  inv[3][3] = 1.0f;
+#endif
+  return inv;
+}
+
+/*
+ * out = a * b, column major. Column j of the product is
+ * a * b[j] = sum_k a[k] * b[j][k], so each output column is 4
+ * broadcast multiply-adds of a's columns.
+ */
+static inline void mul4(const float *a, const float *b, float *out) {
+#if defined(__AVX__)
+  /* Two output columns per 256 bit register */
+  __m256 a0 = _mm256_broadcast_ps((const __m128 *)(a + 0));
+  __m256 a1 = _mm256_broadcast_ps((const __m128 *)(a + 4));
+  __m256 a2 = _mm256_broadcast_ps((const __m128 *)(a + 8));
+  __m256 a3 = _mm256_broadcast_ps((const __m128 *)(a + 12));
+  int j;
+  for (j=0; j<4; j+=2) {
+    const float *b0 = b + 4*j, *b1 = b + 4*(j+1);
+    __m256 r;
+    r = _mm256_mul_ps(a0, _mm256_setr_m128(_mm_set1_ps(b0[0]),
+                                           _mm_set1_ps(b1[0])));
+    r = _mm256_add_ps(r, _mm256_mul_ps(a1, 
+          _mm256_setr_m128(_mm_set1_ps(b0[1]), _mm_set1_ps(b1[1]))));
+    r = _mm256_add_ps(r, _mm256_mul_ps(a2, 
+          _mm256_setr_m128(_mm_set1_ps(b0[2]), _mm_set1_ps(b1[2]))));
+    r = _mm256_add_ps(r, _mm256_mul_ps(a3, 
+          _mm256_setr_m128(_mm_set1_ps(b0[3]), _mm_set1_ps(b1[3]))));
+    _mm256_storeu_ps(out + 4*j, r);
+  }
+#elif defined(__SSE__)
+  __m128 a0 = _mm_loadu_ps(a + 0);
+  __m128 a1 = _mm_loadu_ps(a + 4);
+  __m128 a2 = _mm_loadu_ps(a + 8);
+  __m128 a3 = _mm_loadu_ps(a + 12);
+  int j;
+  for (j=0; j<4; j++) {
+    const float *bj = b + 4*j;
+    __m128 r;
+    r = _mm_mul_ps(a0, _mm_set1_ps(bj[0]));
+    r = _mm_add_ps(r, _mm_mul_ps(a1, _mm_set1_ps(bj[1])));
+    r = _mm_add_ps(r, _mm_mul_ps(a2, _mm_set1_ps(bj[2])));
+    r = _mm_add_ps(r, _mm_mul_ps(a3, _mm_set1_ps(bj[3])));
+    _mm_storeu_ps(out + 4*j, r);
+  }
+#else
+  int i, j, k;
+  for (j=0; j<4; j++) {
+    for (i=0; i<4; i++) {
+      float r = 0.0f;
+      for (k=0; k<4; k++) {
+        r += a[4*k + i] * b[4*j + k];
       }
-    } 
-  } 
-  t[minInd] = 1;
+      out[4*j + i] = r;
+    }
+  }
+#endif
+}
 
-  u = glm::normalize(glm::cross(t,w));
-  v = glm::cross(w, u);
+void mat::mul(const glm::mat4 &a, const glm::mat4 &b, glm::mat4 &out) {
+  mul4(&a[0][0], &b[0][0], &out[0][0]);
+}
 
-  // construct rotation matrix
-  glm::mat3 R_inv(u, v, w);
-  glm::mat3 R = glm::transpose(R_inv);
-  glm::mat3 Rot = glm::transpose(glm::mat3(
-    cos(theta), -sin(theta), 0,
-    sin(theta), cos(theta), 0,
-    0, 0, 1
-  ));
+void mat::mul_batch(const glm::mat4 *a,
+                    const glm::mat4 *b,
+                    glm::mat4 *out,
+                    size_t n)
+{
+  size_t i;
+  for (i=0; i<n; i++) {
+    mul4(&a[i][0][0], &b[i][0][0], &out[i][0][0]);
+  }
+}
+
+void mat::mul_batch(const glm::mat4 &a,
+                    const glm::mat4 *b,
+                    glm::mat4 *out,
+                    size_t n)
+{
+  size_t i;
+  for (i=0; i<n; i++) {
+    mul4(&a[0][0], &b[i][0][0], &out[i][0][0]);
+  }
+}
+
+glm::mat4 mat::trs(const float deg,
+                   const glm::vec3 &axis,
+                   const glm::vec3 &s,
+                   const glm::vec3 &t)
+{
+  /* rot * scale * trans = [R S | R S t], without the products */
+  glm::mat3 R = mat::rot(glm::radians(deg), axis);
+  glm::mat3 RS(R[0] * s[0], R[1] * s[1], R[2] * s[2]);
 
-  return R_inv*Rot*R;
+  glm::mat4 M(RS);
+  M[3] = glm::vec4(RS * t, 1.0f);
+  return M;
 }
@@ -0,0 +1,202 @@
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+#if defined(__SSSE3__)
+  #include <tmmintrin.h>
+#elif defined(__SSE2__)
+  #include <emmintrin.h>
+#endif
+
+#include "pixels.hpp"
+
+#define PARALLEL_MIN_PIXELS (1 << 20) /* Smaller images use one thread */
+#define ROW_BLOCK 64 /* Rows a thread converts at a time */
+#define MAX_THREADS 16
+
+#if defined(__SSSE3__)
+/*
+ * pshufb masks: mask[j][c] moves channel c of 16 pixels to its
+ * places in bytes 16j..16j+15 of the 48 interleaved ones, zeroing
+ * (0x80) the bytes of the other channels.
+ */
+typedef struct RGBMasks {
+  __m128i mask[3][3];
+} RGBMasks;
+
+static const RGBMasks &rgb_masks() {
+  static const RGBMasks masks = []() {
+    RGBMasks m;
+    unsigned char bytes[16];
+    int j, c, k;
+    for (j=0; j<3; j++) {
+      for (c=0; c<3; c++) {
+        for (k=0; k<16; k++) {
+          int p = 16*j + k;
+          bytes[k] = p % 3 == c ? (unsigned char)(p / 3) : 0x80;
+        }
+        m.mask[j][c] = _mm_loadu_si128((const __m128i *)bytes);
+      }
+    }
+    return m;
+  }();
+  return masks;
+}
+#endif
+
+void pixels::interleave(const unsigned char *r,
+                        const unsigned char *g,
+                        const unsigned char *b,
+                        unsigned char *dst,
+                        size_t n) {
+  size_t i = 0;
+#if defined(__SSSE3__)
+  const RGBMasks &m = rgb_masks();
+  for (; i+16<=n; i+=16) {
+    __m128i vr = _mm_loadu_si128((const __m128i *)(r + i));
+    __m128i vg = _mm_loadu_si128((const __m128i *)(g + i));
+    __m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+    int j;
+    for (j=0; j<3; j++) {
+      __m128i o = _mm_or_si128(
+        _mm_or_si128(_mm_shuffle_epi8(vr, m.mask[j][0]),
+                     _mm_shuffle_epi8(vg, m.mask[j][1])),
+        _mm_shuffle_epi8(vb, m.mask[j][2]));
+      _mm_storeu_si128((__m128i *)(dst + 3*i + 16*j), o);
+    }
+  }
+#endif
+  for (; i<n; i++) {
+    dst[3*i] = r[i];
+    dst[3*i+1] = g[i];
+    dst[3*i+2] = b[i];
+  }
+}
+
+void pixels::interleave(const unsigned char *r,
+                        const unsigned char *g,
+                        const unsigned char *b,
+                        const unsigned char *a,
+                        unsigned char *dst,
+                        size_t n) {
+  size_t i = 0;
+#if defined(__SSE2__)
+  /* Bytes to (r,g) and (b,a) pairs, pairs to pixels */
+  __m128i opaque = _mm_set1_epi8((char)0xFF);
+  for (; i+16<=n; i+=16) {
+    __m128i vr = _mm_loadu_si128((const __m128i *)(r + i));
+    __m128i vg = _mm_loadu_si128((const __m128i *)(g + i));
+    __m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+    __m128i va = a != NULL ?
+      _mm_loadu_si128((const __m128i *)(a + i)) : opaque;
+
+    __m128i rg_lo = _mm_unpacklo_epi8(vr, vg);
+    __m128i rg_hi = _mm_unpackhi_epi8(vr, vg);
+    __m128i ba_lo = _mm_unpacklo_epi8(vb, va);
+    __m128i ba_hi = _mm_unpackhi_epi8(vb, va);
+
+    __m128i *out = (__m128i *)(dst + 4*i);
+    _mm_storeu_si128(out, _mm_unpacklo_epi16(rg_lo, ba_lo));
+    _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(rg_lo, ba_lo));
+    _mm_storeu_si128(out + 2, _mm_unpacklo_epi16(rg_hi, ba_hi));
+    _mm_storeu_si128(out + 3, _mm_unpackhi_epi16(rg_hi, ba_hi));
+  }
+#endif
+  for (; i<n; i++) {
+    dst[4*i] = r[i];
+    dst[4*i+1] = g[i];
+    dst[4*i+2] = b[i];
+    dst[4*i+3] = a != NULL ? a[i] : 0xFF;
+  }
+}
+
+void pixels::planar_to_gl(const unsigned char *planes,
+                          int stride,
+                          int rows,
+                          int channels,
+                          int width,
+                          int height,
+                          int out,
+                          unsigned char *dst,
+                          int threads) {
+  size_t plane = (size_t)stride * rows;
+  bool rgb = channels >= 3;
+  const unsigned char *r = planes;
+  const unsigned char *g = rgb ? planes + plane : planes;
+  const unsigned char *b = rgb ? planes + 2*plane : planes;
+  const unsigned char *a = channels == 2 ? planes + plane :
+                           channels >= 4 ? planes + 3*plane : NULL;
+
+  /* Row y of the texture is row height-1-y of the image */
+  auto convert = [=](int y0, int y1) {
+    int y;
+    for (y=y0; y<y1; y++) {
+      size_t src = (size_t)(height - 1 - y) * stride;
+      unsigned char *row = dst + (size_t)y * width * out;
+      if (out == 4) {
+        interleave(r + src, g + src, b + src,
+                   a != NULL ? a + src : NULL, row, width);
+      } else {
+        interleave(r + src, g + src, b + src, row, width);
+      }
+    }
+  };
+
+  if (threads <= 0) {
+    threads = (int)std::thread::hardware_concurrency();
+  }
+  threads = std::min(threads, MAX_THREADS);
+  threads = std::min(threads, (height + ROW_BLOCK - 1) / ROW_BLOCK);
+  if ((size_t)width * height < PARALLEL_MIN_PIXELS || threads <= 1) {
+    convert(0, height);
+    return;
+  }
+
+  /* Blocks are handed out in order, so threads share the work */
+  std::atomic<int> next(0);
+  auto run = [&]() {
+    int y0;
+    while ((y0 = next.fetch_add(ROW_BLOCK)) < height) {
+      convert(y0, std::min(y0 + ROW_BLOCK, height));
+    }
+  };
+  std::vector<std::thread> pool;
+  int i;
+  for (i=1; i<threads; i++) {
+    pool.push_back(std::thread(run));
+  }
+  run();
+  for (std::thread &t : pool) {
+    t.join();
+  }
+}
+
+void pixels::downsample(const unsigned char *src,
+                        int width,
+                        int height,
+                        int channels,
+                        unsigned char *dst) {
+  int w = std::max(width / 2, 1);
+  int h = std::max(height / 2, 1);
+
+  /* A side of 1 has no neighbour to average with */
+  size_t dx = width > 1 ? channels : 0;
+  size_t dy = height > 1 ? (size_t)width * channels : 0;
+
+  int x, y, c;
+  for (y=0; y<h; y++) {
+    const unsigned char *s0 = src + (size_t)2*y * width * channels;
+    const unsigned char *s1 = s0 + dy;
+    unsigned char *d = dst + (size_t)y * w * channels;
+    for (x=0; x<w; x++) {
+      const unsigned char *p0 = s0 + (size_t)2*x * channels;
+      const unsigned char *p1 = s1 + (size_t)2*x * channels;
+      for (c=0; c<channels; c++) {
+        d[c] = (unsigned char)((p0[c] + p0[c+dx] +
+                                p1[c] + p1[c+dx] + 2) >> 2);
+      }
+      d += channels;
+    }
+  }
+}
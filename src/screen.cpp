@@ -1,139 +1,136 @@
+#include <string.h>
+#include <string>
 #include <glad/glad.h>
 #include "lib.hpp"
+#include "types.hpp"
 
-static void 
-save_as_tga(unsigned char *data,
-            const size_t data_size,
-            const size_t width,
-            const size_t height,
-            const bool free_data,
-            const screen::ImageType type,
-            const char *filename)
+#define WRITER_THREADS 2
+#define WRITER_BUFFERS 8 /* Images in flight before captures block */
+
+static bool ends_with(const std::string &s, const char *suffix) {
+  size_t n = strlen(suffix);
+  return s.size() >= n && s.compare(s.size() - n, n, suffix) == 0;
+}
+
+/* Copy out of the mapped pack buffer and queue the file */
+static void queue_image(const unsigned char *data,
+                        const size_t size,
+                        const int width,
+                        const int height,
+                        const screen::ImageType type,
+                        const std::string &path)
 {
-  /* 
-   * Tightly pack - not used due to memory alignment
-   * causing some fields to be offset from TGA
-   * file specification
-   */ 
-  #pragma pack(1)
-  struct {
-    unsigned char identsize;    // Size of folowing ID field
-    unsigned char cmaptype;     // Color map type 0 = none
-    unsigned char imagetype;    // Image type 2 = rgb
-    short cmapstart;            // First entry in palette
-    short cmapsize;             // Number of entries in palette 
-    unsigned char cmapbpp;      // Number of bits per palette entry
-    short xorigin;              // X origin
-    short yorigin;              // Y origin
-    short width;                // Width in pixels
-    short height;               // Height in pixels
-    unsigned char bpp;          // Bits per pixel
-    unsigned char descriptor;   // Descriptor bits
-  } tga_header;
+  ImageWriter &writer = screen::writer();
+  ImageWriter::Buffer *buf = writer.acquire(size);
+  memcpy(buf->data(), data, size);
+  writer.submit(buf, width, height, type, screen::image_format(path), path);
+}
 
-  unsigned char imagetype, bpp;
-  using namespace screen;
-  switch (type) {
-    case ImageType::IMAGE_TYPE_GREYSCALE:
-      imagetype = 3;
-      bpp = 8;
-      break;
-    default:
-    case ImageType::IMAGE_TYPE_RGB:
-      imagetype = 2;
-      bpp = 24;
-      break;
+screen::ImageFormat 
+screen::image_format(const std::string &path)
+{
+  if (ends_with(path, ".tga")) {
+    return ImageFormat::IMAGE_FORMAT_TGA_RLE;
+  } else if (ends_with(path, ".png")) {
+    return ImageFormat::IMAGE_FORMAT_PNG;
   }
+  return ImageFormat::IMAGE_FORMAT_RAW;
+}
 
-  memset(&tga_header, 0, sizeof(tga_header));
-  tga_header.imagetype = imagetype;
-  tga_header.bpp = bpp;
-  tga_header.width = (short)width;
-  tga_header.height = (short)height;
-
-  FILE *f_out = fopen(filename, "wb");
-  fwrite(&tga_header, sizeof(tga_header), 1, f_out);
-  fwrite(data, data_size, 1, f_out);
-  fclose(f_out);
+ImageWriter &
+screen::writer()
+{
+  /* Joined at exit, after the last queued image is written */
+  static ImageWriter writer(WRITER_THREADS, WRITER_BUFFERS);
+  return writer;
+}
 
-  if (free_data) {
-    free(data);
-  }
+void 
+screen::finish()
+{
+  screen::writer().wait();
 }
 
-unsigned char *
-screen::read_depth_tex_layer(const GLuint tex,
+void 
+screen::read_depth_tex_layer(Readback &readback,
+                             const GLuint tex,
                              const int width,
                              const int height,
-                             const int layer)
+                             const int layer,
+                             const ReadCallback &done)
 {
-  unsigned char *data;
-  data = (unsigned char *)malloc(width * height);
-  glGetTextureSubImage(tex,
-                       0,
-                       0,
-                       0,
-                       layer,
-                       width,
-                       height,
-                       1,
-                       GL_DEPTH_COMPONENT,
-                       GL_UNSIGNED_BYTE,
-                       width * height,
-                       data);
-
-  return data;
+  readback.read_texture(tex,
+                        layer,
+                        width,
+                        height,
+                        GL_DEPTH_COMPONENT,
+                        GL_UNSIGNED_BYTE,
+                        width * height,
+                        done);
 }
 
 void 
-screen::depth_3D_layer_screenshot(const GLuint tex,
+screen::depth_3D_layer_screenshot(Readback &readback,
+                                  const GLuint tex,
                                   const int width,
                                   const int height,
                                   const int layer,
                                   const char *filename)
 {
-  unsigned char *data;
-  data = screen::read_depth_tex_layer(tex,
-                                      width,
-                                      height,
-                                      layer);
-  save_as_tga(data,
-              width * height,
-              width,
-              height,
-              true,
-              ImageType::IMAGE_TYPE_GREYSCALE,
-              filename); 
+  std::string path(filename);
+  screen::read_depth_tex_layer(readback,
+                               tex,
+                               width,
+                               height,
+                               layer,
+    [=](const unsigned char *data, size_t size) {
+      queue_image(data, size, width, height,
+                  ImageType::IMAGE_TYPE_GREYSCALE, path);
+    });
 }
 
 void 
-screen::depth_2D_screenshot(const GLuint FBO,
+screen::depth_2D_screenshot(Readback &readback,
+                            const GLuint FBO,
                             const GLenum mode,
                             const screen::ImageType type, 
                             const int width,
                             const int height,
                             const char *output_file)
 {
-  unsigned char *data;
-
-  int data_size = width * height;
-  data = (unsigned char *)malloc(data_size);
-
-  glBindFramebuffer(GL_FRAMEBUFFER, FBO);
-  glReadBuffer(mode);
-  glReadPixels(0, 0,
-               width, height,
-               GL_DEPTH_COMPONENT, GL_UNSIGNED_BYTE,
-               data);
-  glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-  save_as_tga(data,
-              data_size,
-              width,
-              height,
-              true,
-              ImageType::IMAGE_TYPE_GREYSCALE,
-              output_file);
+  std::string path(output_file);
+  readback.read_pixels(FBO,
+                       mode,
+                       width,
+                       height,
+                       GL_DEPTH_COMPONENT,
+                       GL_UNSIGNED_BYTE,
+                       width * height,
+    [=](const unsigned char *data, size_t size) {
+      queue_image(data, size, width, height,
+                  ImageType::IMAGE_TYPE_GREYSCALE, path);
+    });
 }
 
-
+void 
+screen::color_2D_screenshot(Readback &readback,
+                            const GLuint FBO,
+                            const GLenum mode,
+                            const int width,
+                            const int height,
+                            const char *output_file)
+{
+  /* TGA stores BGR, bottom row first - the same as GL */
+  std::string path(output_file);
+  readback.read_pixels(FBO,
+                       mode,
+                       width,
+                       height,
+                       GL_BGR,
+                       GL_UNSIGNED_BYTE,
+                       3 * width * height,
+    [=](const unsigned char *data, size_t size) {
+      queue_image(data, size, width, height,
+                  ImageType::IMAGE_TYPE_RGB, path);
+    });
+}
@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <glad/glad.h>
+
+#include "shader_cache.hpp"
+#include "trace.hpp"
+
+#define SHADER_CACHE_DIR "../.shader-cache"
+#define SHADER_CACHE_MAGIC 0x31424353 /* "SCB1" */
+
+namespace {
+  typedef struct Header {
+    uint32_t magic;
+    uint32_t format; /* GLenum binary format */
+    uint64_t key;
+    uint32_t length;
+  } Header;
+
+  /* FNV-1a, 64 bit */
+  uint64_t hash(uint64_t h, const void *data, size_t size) {
+    const unsigned char *p = (const unsigned char *)data;
+    size_t i;
+    for (i=0; i<size; i++) {
+      h ^= p[i];
+      h *= 1099511628211ULL;
+    }
+    return h;
+  }
+
+  uint64_t hash(uint64_t h, const std::string &s) {
+    /* Include the length so "ab"+"c" and "a"+"bc" differ */
+    uint64_t n = s.size();
+    h = hash(h, &n, sizeof(n));
+    return hash(h, s.data(), s.size());
+  }
+
+  std::string gl_string(GLenum name) {
+    const char *s = (const char *)glGetString(name);
+    return s != NULL ? s : "";
+  }
+
+  std::string path(uint64_t key) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%s/%016llx.bin",
+             SHADER_CACHE_DIR, (unsigned long long)key);
+    return buf;
+  }
+}
+
+uint64_t shader_cache::key(const std::vector<ShaderProg> &shader_progs) {
+  GLint formats = 0;
+  glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+  if (formats == 0) {
+    return 0;
+  }
+
+  uint64_t h = 14695981039346656037ULL;
+  h = hash(h, gl_string(GL_VENDOR));
+  h = hash(h, gl_string(GL_RENDERER));
+  h = hash(h, gl_string(GL_VERSION));
+  for (const ShaderProg &p : shader_progs) {
+    uint32_t type = p.type;
+    h = hash(h, &type, sizeof(type));
+    h = hash(h, p.code);
+  }
+  return h != 0 ? h : 1;
+}
+
+GLuint shader_cache::load(uint64_t key) {
+  if (key == 0) {
+    return 0;
+  }
+  TRACE_ZONE("shader_cache::load");
+
+  FILE *f = fopen(path(key).c_str(), "rb");
+  if (f == NULL) {
+    return 0;
+  }
+
+  Header header;
+  std::vector<char> binary;
+  bool ok = fread(&header, sizeof(header), 1, f) == 1 &&
+            header.magic == SHADER_CACHE_MAGIC &&
+            header.key == key;
+  if (ok) {
+    binary.resize(header.length);
+    ok = fread(binary.data(), 1, binary.size(), f) == binary.size();
+  }
+  fclose(f);
+  if (!ok) {
+    return 0;
+  }
+
+  GLuint prog = glCreateProgram();
+  glProgramBinary(prog, header.format, binary.data(), header.length);
+
+  /* Drivers may refuse their own binaries, e.g. after an update */
+  GLint status = 0;
+  glGetProgramiv(prog, GL_LINK_STATUS, &status);
+  if (!status) {
+    glDeleteProgram(prog);
+    return 0;
+  }
+  return prog;
+}
+
+void shader_cache::store(uint64_t key, GLuint prog) {
+  if (key == 0) {
+    return;
+  }
+  TRACE_ZONE("shader_cache::store");
+
+  GLint length = 0;
+  glGetProgramiv(prog, GL_PROGRAM_BINARY_LENGTH, &length);
+  if (length <= 0) {
+    return;
+  }
+
+  Header header;
+  memset(&header, 0, sizeof(header));
+  std::vector<char> binary(length);
+  GLenum format;
+  glGetProgramBinary(prog, length, &length, &format, binary.data());
+  header.magic = SHADER_CACHE_MAGIC;
+  header.format = format;
+  header.key = key;
+  header.length = length;
+
+  /* Written aside and renamed, so readers never see half a file */
+  mkdir(SHADER_CACHE_DIR, 0755);
+  std::string file = path(key);
+  std::string tmp = file + ".tmp";
+  FILE *f = fopen(tmp.c_str(), "wb");
+  if (f == NULL) {
+    printf("Failed to open file: %s\n", tmp.c_str());
+    return;
+  }
+  bool ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+            fwrite(binary.data(), 1, length, f) == (size_t)length;
+  ok = fclose(f) == 0 && ok;
+  if (!ok || rename(tmp.c_str(), file.c_str()) != 0) {
+    printf("Failed to write file: %s\n", file.c_str());
+    remove(tmp.c_str());
+  }
+}
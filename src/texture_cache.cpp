@@ -0,0 +1,204 @@
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "texture_cache.hpp"
+#include "trace.hpp"
+
+#define TEXTURE_CACHE_DIR "../.texture-cache"
+#define KTX_ENDIANNESS 0x04030201
+#define KTX_ORIENTATION "KTXorientation\0S=r,T=u" /* Bottom up */
+#define MAX_LEVELS 32
+
+namespace {
+  const unsigned char ktx_identifier[12] = {
+    0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n'
+  };
+
+  typedef struct Header {
+    unsigned char identifier[12];
+    uint32_t endianness;
+    uint32_t gl_type;
+    uint32_t gl_type_size;
+    uint32_t gl_format;
+    uint32_t gl_internal_format;
+    uint32_t gl_base_internal_format;
+    uint32_t width;
+    uint32_t height;
+    uint32_t depth;
+    uint32_t array_elements;
+    uint32_t faces;
+    uint32_t levels;
+    uint32_t key_value_bytes;
+  } Header;
+
+  /* FNV-1a, 64 bit */
+  uint64_t hash(uint64_t h, const void *data, size_t size) {
+    const unsigned char *p = (const unsigned char *)data;
+    size_t i;
+    for (i=0; i<size; i++) {
+      h ^= p[i];
+      h *= 1099511628211ULL;
+    }
+    return h;
+  }
+
+  std::string path(uint64_t key) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%s/%016llx.ktx",
+             TEXTURE_CACHE_DIR, (unsigned long long)key);
+    return buf;
+  }
+
+  constexpr size_t pad4(size_t n) {
+    return (n + 3) & ~(size_t)3;
+  }
+}
+
+uint64_t texture_cache::key(const std::string &file,
+                            GLenum format,
+                            bool mipmaps) {
+  struct stat st;
+  if (stat(file.c_str(), &st) != 0) {
+    return 0;
+  }
+
+  uint64_t h = 14695981039346656037ULL;
+  h = hash(h, file.data(), file.size() + 1);
+  int64_t size = st.st_size, mtime = st.st_mtime;
+  uint32_t fmt = format, mips = mipmaps;
+  h = hash(h, &size, sizeof(size));
+  h = hash(h, &mtime, sizeof(mtime));
+  h = hash(h, &fmt, sizeof(fmt));
+  h = hash(h, &mips, sizeof(mips));
+  return h != 0 ? h : 1;
+}
+
+bool texture_cache::load(uint64_t key, Image &image) {
+  if (key == 0) {
+    return false;
+  }
+  TRACE_ZONE("texture_cache::load");
+
+  int fd = open(path(key).c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  void *map = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(Header)) {
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  close(fd);
+  if (map == MAP_FAILED) {
+    return false;
+  }
+
+  const unsigned char *base = (const unsigned char *)map;
+  size_t size = st.st_size;
+  Header header;
+  memcpy(&header, base, sizeof(header));
+  bool ok = memcmp(header.identifier, ktx_identifier, 12) == 0 &&
+            header.endianness == KTX_ENDIANNESS &&
+            header.faces == 1 &&
+            header.depth == 0 &&
+            header.levels >= 1 && header.levels <= MAX_LEVELS;
+
+  /* Each level: its size, then the data padded to 4 bytes */
+  image.levels.clear();
+  image.sizes.clear();
+  size_t offset = sizeof(Header) + header.key_value_bytes;
+  uint32_t l;
+  for (l=0; ok && l<header.levels; l++) {
+    uint32_t level_size;
+    ok = offset + sizeof(level_size) <= size;
+    if (ok) {
+      memcpy(&level_size, base + offset, sizeof(level_size));
+      offset += sizeof(level_size);
+      ok = offset + level_size <= size;
+    }
+    if (ok) {
+      image.levels.push_back(base + offset);
+      image.sizes.push_back(level_size);
+      offset += pad4(level_size);
+    }
+  }
+  if (!ok) {
+    munmap(map, size);
+    image.levels.clear();
+    image.sizes.clear();
+    return false;
+  }
+
+  image.format = header.gl_internal_format;
+  image.width = header.width;
+  image.height = header.height;
+  image.map = map;
+  image.map_size = size;
+  return true;
+}
+
+void texture_cache::release(Image &image) {
+  if (image.map != NULL) {
+    munmap(image.map, image.map_size);
+    image.map = NULL;
+  }
+  image.levels.clear();
+  image.sizes.clear();
+}
+
+void texture_cache::store(uint64_t key, const Image &image) {
+  if (key == 0) {
+    return;
+  }
+  TRACE_ZONE("texture_cache::store");
+
+  Header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.identifier, ktx_identifier, 12);
+  header.endianness = KTX_ENDIANNESS;
+  header.gl_type_size = 1;
+  header.gl_internal_format = image.format;
+  header.gl_base_internal_format = GL_RGB;
+  header.width = image.width;
+  header.height = image.height;
+  header.faces = 1;
+  header.levels = image.levels.size();
+
+  /* One key/value pair, its size and its bytes padded to 4 */
+  uint32_t kv_size = sizeof(KTX_ORIENTATION);
+  unsigned char kv[pad4(sizeof(KTX_ORIENTATION))];
+  memset(kv, 0, sizeof(kv));
+  memcpy(kv, KTX_ORIENTATION, kv_size);
+  header.key_value_bytes = sizeof(kv_size) + sizeof(kv);
+
+  /* Written aside and renamed, so readers never see half a file */
+  mkdir(TEXTURE_CACHE_DIR, 0755);
+  std::string file = path(key);
+  std::string tmp = file + ".tmp";
+  FILE *f = fopen(tmp.c_str(), "wb");
+  if (f == NULL) {
+    printf("Failed to open file: %s\n", tmp.c_str());
+    return;
+  }
+  const unsigned char zeros[4] = {0, 0, 0, 0};
+  bool ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+            fwrite(&kv_size, sizeof(kv_size), 1, f) == 1 &&
+            fwrite(kv, sizeof(kv), 1, f) == 1;
+  size_t l;
+  for (l=0; ok && l<image.levels.size(); l++) {
+    uint32_t level_size = image.sizes[l];
+    size_t padding = pad4(level_size) - level_size;
+    ok = fwrite(&level_size, sizeof(level_size), 1, f) == 1 &&
+         fwrite(image.levels[l], 1, level_size, f) == level_size &&
+         fwrite(zeros, 1, padding, f) == padding;
+  }
+  ok = fclose(f) == 0 && ok;
+  if (!ok || rename(tmp.c_str(), file.c_str()) != 0) {
+    printf("Failed to write file: %s\n", file.c_str());
+    remove(tmp.c_str());
+  }
+}
@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+
+#include "trace.hpp"
+
+namespace {
+  typedef struct Event {
+    const char *name;
+    std::string detail;
+    int64_t begin_us;
+    int64_t dur_us;
+  } Event;
+
+  typedef struct Buffer {
+    int tid;
+    std::mutex lock; /* Owner appending vs write() copying */
+    std::vector<Event> events;
+  } Buffer;
+
+  std::atomic<bool> enabled(false);
+
+  /*
+   * Buffers outlive their threads, so events of finished worker
+   * threads still make it into the dump.
+   */
+  std::mutex registry_lock;
+  std::vector<Buffer *> registry;
+
+  thread_local Buffer *local = NULL;
+
+  Buffer *local_buffer() {
+    if (local == NULL) {
+      std::lock_guard<std::mutex> guard(registry_lock);
+      local = new Buffer;
+      local->tid = (int)registry.size() + 1;
+      local->events.reserve(1024);
+      registry.push_back(local);
+    }
+    return local;
+  }
+
+  void write_escaped(FILE *f, const std::string &s) {
+    for (char c : s) {
+      if (c == '"' || c == '\\') {
+        fprintf(f, "\\%c", c);
+      } else if ((unsigned char)c < 0x20) {
+        fprintf(f, "\\u%04x", c);
+      } else {
+        fputc(c, f);
+      }
+    }
+  }
+}
+
+void trace::start() { enabled = true; }
+void trace::stop() { enabled = false; }
+bool trace::active() { return enabled.load(std::memory_order_relaxed); }
+
+int64_t trace::now_us() {
+  using namespace std::chrono;
+  return duration_cast<microseconds>(
+    steady_clock::now().time_since_epoch()).count();
+}
+
+void trace::record(const char *name, 
+                   const std::string &detail,
+                   int64_t begin_us, 
+                   int64_t end_us) 
+{
+  Event e = {name, detail, begin_us, end_us - begin_us};
+  Buffer *b = local_buffer();
+  std::lock_guard<std::mutex> guard(b->lock);
+  b->events.push_back(e);
+}
+
+bool trace::write(const std::string &filename) {
+  FILE *f = fopen(filename.c_str(), "w");
+  if (f == NULL) {
+    printf("Failed to open file: %s\n", filename.c_str());
+    return false;
+  }
+
+  std::lock_guard<std::mutex> guard(registry_lock);
+  fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  bool first = true;
+  for (Buffer *b : registry) {
+    fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+               "\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+      first ? "" : ",\n", b->tid, b->tid == 1 ? "main" : "worker");
+    first = false;
+
+    /* Copied out, so the owner is not held up by the file writes */
+    std::vector<Event> events;
+    {
+      std::lock_guard<std::mutex> buffer_guard(b->lock);
+      events = b->events;
+    }
+    for (const Event &e : events) {
+      fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"render\",\"ph\":\"X\","
+                 "\"pid\":1,\"tid\":%d,\"ts\":%lld,\"dur\":%lld",
+        e.name, b->tid, (long long)e.begin_us, (long long)e.dur_us);
+      if (!e.detail.empty()) {
+        fprintf(f, ",\"args\":{\"detail\":\"");
+        write_escaped(f, e.detail);
+        fprintf(f, "\"}");
+      }
+      fprintf(f, "}");
+    }
+  }
+  fprintf(f, "\n]}\n");
+  fclose(f);
+  return true;
+}